@@ -38,6 +38,26 @@ DOCUMENT_SMALL  = File.read("#{DIR}/html/document-small.html").encode('UTF-8', :
 FRAGMENT_LARGE = File.read("#{DIR}/html/fragment-large.html").encode('UTF-8', :invalid => :replace, :undef => :replace)
 FRAGMENT_SMALL = File.read("#{DIR}/html/fragment-small.html").encode('UTF-8', :invalid => :replace, :undef => :replace)
 
+# Generated markup in the style of data-attribute-heavy widgets: every element
+# carries hundreds of attributes, with each name repeated once at the end.
+FRAGMENT_ATTRIBUTES = Array.new(50) { |i|
+  attrs = Array.new(300) { |j| %( data-w#{i}-#{j}="#{j}") }.join
+  %(<div class="widget"#{attrs}#{attrs}>widget #{i}</div>)
+}.join("\n").encode('UTF-8')
+
+# Escaped user content, such as code samples and quoted markup, where most
+# text is character references.
+FRAGMENT_ENTITIES = Array.new(2000) { |i|
+  %(<p title="&quot;#{i}&quot; &amp; more">&lt;a href=&quot;/x?a=1&amp;b=#{i}&quot;&gt;) +
+  %(it&#39;s&nbsp;&lt;b&gt;&amp;amp;&lt;/b&gt; &copy; &#x2014; &hellip;&lt;/a&gt;</p>)
+}.join("\n").encode('UTF-8')
+
+# One very wide list, nearly all of whose markup gets stripped: each item is
+# unwrapped in place and its span hoisted into the list.
+FRAGMENT_WIDE = ("<ul>" + Array.new(10_000) { |i|
+  %(<li><span class="item" data-i="#{i}">item #{i}</span></li>)
+}.join + "</ul>").encode('UTF-8')
+
 require "#{DIR}/helpers"
 
 class Benchmark < Measure
@@ -101,6 +121,10 @@ class Benchmark < Measure
 
         Cleanse::DocumentFragment.new(html, sanitizer: sanitizer)
       end
+
+      measure('Cleanse.sanitize', times) do
+        Cleanse.sanitize(html, sanitizer: sanitizer)
+      end
     else
       measure('Cleanse#document', times) do
         Cleanse::Document.new(html)
@@ -110,6 +134,10 @@ class Benchmark < Measure
       measure('Cleanse.document', times) do
         Cleanse::Document.new(html, sanitizer: sanitizer)
       end
+
+      measure('Cleanse.sanitize (document)', times) do
+        Cleanse.sanitize(html, sanitizer: sanitizer, fragment: false)
+      end
     end
   end
 end
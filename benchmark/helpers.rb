@@ -86,6 +86,21 @@ module TestSet
     bench(FRAGMENT_LARGE, n, true)
     puts
 
+    n = 100 / scale
+    puts "  Attribute-heavy HTML fragment (#{FRAGMENT_ATTRIBUTES.length} bytes) x #{n}"
+    bench(FRAGMENT_ATTRIBUTES, n, true)
+    puts
+
+    n = 100 / scale
+    puts "  Entity-dense HTML fragment (#{FRAGMENT_ENTITIES.length} bytes) x #{n}"
+    bench(FRAGMENT_ENTITIES, n, true)
+    puts
+
+    n = 20 / scale
+    puts "  Wide HTML fragment (#{FRAGMENT_WIDE.length} bytes) x #{n}"
+    bench(FRAGMENT_WIDE, n, true)
+    puts
+
     n = 100 / scale
     puts "  Small HTML document (#{DOCUMENT_SMALL.length} bytes) x #{n}"
     bench(DOCUMENT_SMALL, n, false)
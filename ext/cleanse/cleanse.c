@@ -1,4 +1,5 @@
 #include "cleanse.h"
+#include <ruby/thread.h>
 
 #include "gumbo.h"
 
@@ -46,10 +47,44 @@ void strcheck(VALUE rb_str)
   }
 }
 
+/*
+ * Runs `func` with the GVL released so other Ruby threads can make progress
+ * while we parse, sanitize or serialize. `func` must not touch any Ruby
+ * object or raise; small units of work just run inline.
+ */
+void *cleanse_without_gvl(void *(*func)(void *), void *data, long work_size)
+{
+  if (work_size < CLEANSE_NOGVL_THRESHOLD) {
+    return func(data);
+  }
+  return rb_thread_call_without_gvl(func, data, NULL, NULL);
+}
+
+/*
+ * Returns a string whose contents stay put while the GVL is released: a
+ * frozen (shared, copy-on-write) view of `rb_str`, so that other threads
+ * cannot modify it under us. Inputs that will be handled inline are
+ * returned as-is.
+ */
+VALUE cleanse_str_for_nogvl(VALUE rb_str)
+{
+  if (RSTRING_LEN(rb_str) < CLEANSE_NOGVL_THRESHOLD) {
+    return rb_str;
+  }
+  return rb_str_new_frozen(rb_str);
+}
+
 __attribute__ ((visibility ("default"))) void Init_cleanse(void)
 {
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+  // No mutable global state: every call works on its own document, and
+  // sanitizers shared across Ractors are frozen.
+  rb_ext_ractor_safe(true);
+#endif
+
   rb_mCleanse = rb_define_module("Cleanse");
   Init_cleanse_document();
   Init_cleanse_sanitizer();
   Init_cleanse_serializer();
+  Init_cleanse_batch();
 }
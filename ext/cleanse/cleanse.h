@@ -17,6 +17,10 @@
 #define OPTHASH_GIVEN_P(opts) \
   (argc > 0 && !NIL_P((opts) = rb_check_hash_type(argv[argc - 1])) && (--argc, 1))
 
+#ifndef RUBY_TYPED_FROZEN_SHAREABLE
+#define RUBY_TYPED_FROZEN_SHAREABLE 0
+#endif
+
 static inline VALUE
 strbuf_to_rb(GumboStringBuffer *buffer, bool do_free)
 {
@@ -43,9 +47,31 @@ extern VALUE rb_mConfig;
 extern VALUE rb_cTextNode;
 extern VALUE rb_cElementNode;
 
-void cleanse_reparent_children_at(GumboNode *parent, GumboVector *new_children,
-                                  unsigned int pos_at, bool wrap);
-void cleanse_remove_child_at(GumboNode *parent, unsigned int pos_at, bool wrap);
+extern const rb_data_type_t cleanse_sanitizer_type;
+extern const rb_data_type_t cleanse_document_type;
+
+/*
+ * Node types, beyond GumboNodeType's, that wrapping a removed element in
+ * whitespace leaves in its place, so that doing so needs no new nodes or
+ * text. A spacer serializes as a single space; a spaced node as its
+ * children with a space either side, as if they were children of its
+ * parent.
+ */
+enum
+{
+  CLEANSE_NODE_SPACER = GUMBO_NODE_TEMPLATE + 1,
+  CLEANSE_NODE_SPACED,
+};
+
+/*
+ * Tree surgery for the sanitizer. `child` is a child of `parent` and
+ * `prev` its previous sibling, or GUMBO_COMPACT_NONE if it is the first
+ * child. Neither call allocates.
+ */
+void cleanse_remove_child(GumboCompactTree *tree, GumboNodeIndex parent,
+                          GumboNodeIndex prev, GumboNodeIndex child, bool wrap);
+void cleanse_reparent_children(GumboCompactTree *tree, GumboNodeIndex parent,
+                               GumboNodeIndex prev, GumboNodeIndex child, bool wrap);
 
 void rb_cleanse_selector_check(VALUE rb_selector);
 VALUE rb_cleanse_selector_coerce(VALUE rb_selector);
@@ -59,6 +85,9 @@ void Init_cleanse(void);
 void Init_cleanse_document(void);
 void Init_cleanse_sanitizer(void);
 void Init_cleanse_serializer(void);
+void Init_cleanse_batch(void);
+
+typedef struct CleanseSanitizerPlan CleanseSanitizerPlan;
 
 typedef struct
 {
@@ -68,8 +97,22 @@ typedef struct
   st_table *element_sanitizers;
   int allow_comments : 1;
   int allow_doctype : 1;
+  CleanseSanitizerPlan *plan;
+  int plan_state;
 } CleanseSanitizer;
 
+/*
+ * Whether a sanitizer's plan reflects its settings. Setters only mark the
+ * plan stale; it is rebuilt once they are done, when the sanitizer is
+ * compiled, frozen or next used.
+ */
+enum
+{
+  CLEANSE_PLAN_CURRENT,
+  CLEANSE_PLAN_STALE,
+  CLEANSE_PLAN_BUILDING,
+};
+
 typedef struct CleanseProtocolSanitizer
 {
   char *name;
@@ -86,19 +129,124 @@ typedef struct
   CleanseProtocolSanitizer *protocols;
 } CleanseElementSanitizer;
 
+/*
+ * The settings above, compiled into the form sanitizing uses: a policy for
+ * every tag, and attribute names numbered so that allow lists and protocol
+ * rules become bitsets. Attribute names that no setting mentions get the
+ * number 0 and are never allowed.
+ *
+ * A plan never changes once built. A rebuild swaps a new one in, and a plan
+ * is reference counted so that it outlives the swap for as long as
+ * anything is still sanitizing with it.
+ */
+typedef struct
+{
+  uint32_t attr;
+  const string_index_t *allowed;
+} CleanseProtocolRule;
+
+typedef struct
+{
+  uint8_t flags;
+  size_t max_nested;
+  bool require_any;
+  const uint64_t *attr_allowed;   /* global and per-element, combined */
+  const uint64_t *attr_required;  /* NULL if nothing is required */
+  const uint64_t *attr_protocols; /* attributes with a protocol rule */
+  const string_index_t *class_allowed; /* NULL if any class is allowed */
+  const CleanseProtocolRule *protocols;
+  uint32_t protocol_count;
+} CleanseElementPolicy;
+
+struct CleanseSanitizerPlan
+{
+  CleanseElementPolicy elements[GUMBO_TAG_LAST];
+  string_index_t attr_names;
+  uint32_t attr_words;
+  uint32_t class_attr;
+  uint32_t charset_attr;
+  const string_index_t *class_allowed;
+  uint64_t *bitsets;
+  CleanseProtocolRule *protocols;
+  string_index_t *allowlists;  /* frozen class and protocol allowlists */
+  uint32_t allowlist_count;
+  bool allow_comments;
+  bool allow_doctype;
+  uint32_t refcount;
+};
+
+static inline bool
+cleanse_attr_in(const uint64_t *bitset, uint32_t attr)
+{
+  return (bitset[attr / 64] >> (attr % 64)) & 1;
+}
+
 CleanseSanitizer *cleanse_sanitizer_new(void);
 void cleanse_sanitizer_free(void *_sanitizer);
+void cleanse_sanitizer_compile(CleanseSanitizer *sanitizer);
+const CleanseSanitizerPlan *cleanse_sanitizer_acquire_plan(CleanseSanitizer *sanitizer);
+void cleanse_sanitizer_release_plan(const CleanseSanitizerPlan *plan);
 CleanseElementSanitizer *cleanse_sanitizer_get_element(CleanseSanitizer *sanitizer, GumboTag t);
 CleanseProtocolSanitizer *cleanse_element_sanitizer_get_proto(
     CleanseElementSanitizer *elem, const char *proto);
-void cleanse_node_sanitize(const CleanseSanitizer *sanitizer, GumboNode *node);
+void cleanse_node_sanitize(const CleanseSanitizerPlan *plan, GumboCompactTree *tree,
+                           GumboNodeIndex node);
 
 void cleanse_escape_html(GumboStringBuffer *out, const char *src,
                          long size, bool in_attribute);
 
-VALUE cleanse_node_alloc(VALUE klass, VALUE rb_document, GumboNode *node);
-VALUE cleanse_parse_to_rb(VALUE klass, VALUE rb_text, GumboTag fragment_ctx);
-GumboOutput *cleanse_parse_fragment(VALUE rb_text, GumboTag fragment_ctx);
+/*
+ * The parse tree behind a Document or DocumentFragment. The tree holds
+ * pointers into the input, the frozen `rb_source` string.
+ */
+typedef struct
+{
+  GumboOutput *output;
+  long source_len;
+  VALUE rb_source;
+} CleanseDocument;
+
+typedef enum
+{
+  CLEANSE_PARSE_OK,
+  CLEANSE_PARSE_NOMEM,
+  CLEANSE_PARSE_FAILED,
+} CleanseParseStatus;
+
+void cleanse_document_free(void *_doc);
+CleanseParseStatus cleanse_parse_fragment(CleanseDocument *doc,
+    const char *input, long input_len, GumboTag fragment_ctx, int max_errors);
+void cleanse_raise_parse_status(CleanseParseStatus status);
+
+const char *cleanse_serialize_output(GumboStringBuffer *out, GumboOutput *output,
+                                     bool fragment, bool allow_doctype);
+
+/*
+ * A complete parse -> sanitize -> serialize run over a C string, with no
+ * intermediate Ruby objects. On success `out` holds the resulting HTML and
+ * belongs to the caller; on failure it has already been released.
+ */
+typedef struct
+{
+  const char *input;
+  long input_len;
+  bool fragment;
+  const CleanseSanitizerPlan *plan;
+  GumboStringBuffer out;
+  CleanseParseStatus status;
+  const char *error;
+} CleanseSanitizeJob;
+
+void cleanse_sanitize_job_run(CleanseSanitizeJob *job);
+
+/*
+ * Inputs smaller than this are handled while holding the GVL; releasing
+ * and reacquiring it costs more than parsing a short fragment does.
+ */
+#define CLEANSE_NOGVL_THRESHOLD 4096
+
+void *cleanse_without_gvl(void *(*func)(void *), void *data, long work_size);
+VALUE cleanse_str_for_nogvl(VALUE rb_str);
 
 extern ID g_id_sanitizer;
 extern ID g_id_html;
@@ -0,0 +1,281 @@
+#include "cleanse.h"
+#include <ruby/thread.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/*
+ * A batch of sanitize jobs shared by a pool of native worker threads.
+ * Inputs are copied into `source` up front, and the batch holds its own
+ * reference to the sanitizer's plan, so workers never look at a Ruby
+ * object; each worker claims the next unstarted job through `next` until
+ * the batch is drained or cancelled.
+ */
+typedef struct {
+  CleanseSanitizeJob *jobs;
+  long count;
+  long next;
+  int cancelled;
+  int threads;
+  char *source;
+  const CleanseSanitizerPlan *plan;
+} CleanseBatch;
+
+static void
+batch_work(CleanseBatch *batch)
+{
+  for (;;) {
+    long i;
+
+    if (__atomic_load_n(&batch->cancelled, __ATOMIC_RELAXED)) {
+      break;
+    }
+
+    i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+    if (i >= batch->count) {
+      break;
+    }
+
+    cleanse_sanitize_job_run(&batch->jobs[i]);
+  }
+}
+
+#ifdef HAVE_PTHREAD_H
+static void *
+batch_worker(void *batch)
+{
+  batch_work(batch);
+  return NULL;
+}
+#endif
+
+static void *
+batch_run_nogvl(void *_batch)
+{
+  CleanseBatch *batch = _batch;
+#ifdef HAVE_PTHREAD_H
+  pthread_t *workers = NULL;
+  int started = 0, i;
+
+  if (batch->threads > 1) {
+    workers = malloc(sizeof(pthread_t) * (batch->threads - 1));
+  }
+
+  // The calling thread is one of the workers, so start one fewer
+  if (workers) {
+    for (i = 0; i < batch->threads - 1; ++i) {
+      if (pthread_create(&workers[started], NULL, batch_worker, batch) != 0) {
+        break;
+      }
+      started++;
+    }
+  }
+
+  batch_work(batch);
+
+  for (i = 0; i < started; ++i) {
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+#else
+  batch_work(batch);
+#endif
+  return NULL;
+}
+
+static void
+batch_cancel(void *_batch)
+{
+  CleanseBatch *batch = _batch;
+  __atomic_store_n(&batch->cancelled, 1, __ATOMIC_RELAXED);
+}
+
+static VALUE
+batch_run_protected(VALUE _batch)
+{
+  CleanseBatch *batch = (CleanseBatch *)_batch;
+  rb_thread_call_without_gvl(batch_run_nogvl, batch, batch_cancel, batch);
+  return Qnil;
+}
+
+static VALUE
+check_ints_protected(VALUE _unused)
+{
+  (void)_unused;
+  rb_thread_check_ints();
+  return Qnil;
+}
+
+static int
+default_thread_count(void)
+{
+#if defined(HAVE_PTHREAD_H) && defined(_SC_NPROCESSORS_ONLN)
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n > 0) {
+    return (int)n;
+  }
+#endif
+  return 1;
+}
+
+static void
+batch_free(CleanseBatch *batch)
+{
+  long i;
+
+  for (i = 0; batch->jobs && i < batch->count; ++i) {
+    CleanseSanitizeJob *job = &batch->jobs[i];
+    if (job->status == CLEANSE_PARSE_OK && !job->error && job->out.data) {
+      strbuf_free(&job->out);
+    }
+  }
+
+  free(batch->jobs);
+  free(batch->source);
+  if (batch->plan) {
+    cleanse_sanitizer_release_plan(batch->plan);
+  }
+}
+
+/*
+ * Converts each job's output into a Ruby string, handing its buffer over
+ * as it goes so that batch_free only frees the ones not yet converted if
+ * this raises partway through.
+ */
+static VALUE
+batch_results(VALUE _batch)
+{
+  CleanseBatch *batch = (CleanseBatch *)_batch;
+  VALUE rb_results = rb_ary_new_capa(batch->count);
+  long i;
+
+  for (i = 0; i < batch->count; ++i) {
+    CleanseSanitizeJob *job = &batch->jobs[i];
+    rb_ary_push(rb_results, strbuf_to_rb(&job->out, true));
+    job->out.data = NULL;
+  }
+  return rb_results;
+}
+
+static VALUE
+batch_free_ensure(VALUE _batch)
+{
+  batch_free((CleanseBatch *)_batch);
+  return Qnil;
+}
+
+/*
+ * call-seq:
+ *   sanitizer.sanitize_all(array_of_html, threads: nil, fragment: true) -> Array
+ *
+ * Sanitizes every string in `array_of_html` with this sanitizer and returns
+ * the results in the same order. The work is spread over `threads` native
+ * threads (default: one per online CPU) with the GVL released. The whole
+ * batch uses the settings the sanitizer had when it was called, even if
+ * another thread changes them while it runs.
+ */
+static VALUE
+rb_cleanse_sanitizer_sanitize_all(int argc, VALUE *argv, VALUE rb_self)
+{
+  VALUE rb_inputs, rb_opts, rb_threads = Qnil, rb_fragment = Qtrue;
+  CleanseSanitizer *sanitizer;
+  CleanseBatch batch;
+  long i, total_len = 0, offset = 0;
+  int threads;
+  bool fragment;
+
+  rb_scan_args(argc, argv, "1:", &rb_inputs, &rb_opts);
+  Check_Type(rb_inputs, T_ARRAY);
+
+  if (!NIL_P(rb_opts)) {
+    rb_threads = rb_hash_lookup(rb_opts, CSTR2SYM("threads"));
+    rb_fragment = rb_hash_lookup2(rb_opts, CSTR2SYM("fragment"), Qtrue);
+  }
+
+  threads = NIL_P(rb_threads) ? default_thread_count() : NUM2INT(rb_threads);
+  if (threads < 1) {
+    rb_raise(rb_eArgError, "threads must be positive");
+  }
+  fragment = RTEST(rb_fragment);
+
+  TypedData_Get_Struct(rb_self, CleanseSanitizer, &cleanse_sanitizer_type, sanitizer);
+
+  for (i = 0; i < RARRAY_LEN(rb_inputs); ++i) {
+    VALUE rb_text = RARRAY_AREF(rb_inputs, i);
+    strcheck(rb_text);
+    total_len += RSTRING_LEN(rb_text);
+  }
+
+  memset(&batch, 0, sizeof(batch));
+  batch.plan = cleanse_sanitizer_acquire_plan(sanitizer);
+  batch.count = RARRAY_LEN(rb_inputs);
+  batch.threads = threads < batch.count ? threads : (int)batch.count;
+  batch.jobs = calloc(batch.count ? batch.count : 1, sizeof(CleanseSanitizeJob));
+  batch.source = malloc(total_len ? total_len : 1);
+
+  if (!batch.jobs || !batch.source) {
+    batch_free(&batch);
+    rb_memerror();
+  }
+
+  for (i = 0; i < batch.count; ++i) {
+    VALUE rb_text = RARRAY_AREF(rb_inputs, i);
+    CleanseSanitizeJob *job = &batch.jobs[i];
+
+    memcpy(batch.source + offset, RSTRING_PTR(rb_text), RSTRING_LEN(rb_text));
+    job->input = batch.source + offset;
+    job->input_len = RSTRING_LEN(rb_text);
+    job->fragment = fragment;
+    job->plan = batch.plan;
+    job->status = CLEANSE_PARSE_OK;
+    offset += job->input_len;
+  }
+
+  if (total_len < CLEANSE_NOGVL_THRESHOLD) {
+    batch.threads = 1;
+    batch_run_nogvl(&batch);
+  } else {
+    for (;;) {
+      int state = 0;
+
+      // Returning to Ruby may itself raise, once the workers have finished
+      rb_protect(batch_run_protected, (VALUE)&batch, &state);
+      if (!state && !batch.cancelled) {
+        break;
+      }
+
+      // We were interrupted: let Ruby handle it (which may raise), then
+      // pick up the remaining jobs where the workers left off
+      if (!state) {
+        rb_protect(check_ints_protected, Qnil, &state);
+      }
+      if (state) {
+        batch_free(&batch);
+        rb_jump_tag(state);
+      }
+      batch.cancelled = 0;
+    }
+  }
+  RB_GC_GUARD(rb_self);
+
+  for (i = 0; i < batch.count; ++i) {
+    CleanseSanitizeJob *job = &batch.jobs[i];
+    if (job->status != CLEANSE_PARSE_OK || job->error) {
+      CleanseParseStatus status = job->status;
+      const char *error = job->error;
+
+      batch_free(&batch);
+      cleanse_raise_parse_status(status);
+      rb_raise(rb_eRuntimeError, "%s", error);
+    }
+  }
+
+  return rb_ensure(batch_results, (VALUE)&batch, batch_free_ensure, (VALUE)&batch);
+}
+
+void Init_cleanse_batch(void)
+{
+  rb_define_method(rb_cSanitizer, "sanitize_all", rb_cleanse_sanitizer_sanitize_all, -1);
+}
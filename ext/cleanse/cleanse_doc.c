@@ -12,130 +12,377 @@ VALUE rb_cElementNode;
 
 ID g_id_sanitizer;
 ID g_id_html;
+static ID g_id_default;
 
-VALUE cleanse_node_alloc(VALUE klass, VALUE rb_document, GumboNode *node)
+static void
+cleanse_document_mark(void *_doc)
 {
-  VALUE rb_node = Data_Wrap_Struct(klass, NULL, NULL, node);
-  rb_iv_set(rb_node, "@document", rb_document);
-  return rb_node;
+  CleanseDocument *doc = _doc;
+  // Marked (and so pinned) since the tree may point into the string
+  rb_gc_mark(doc->rb_source);
 }
 
-static void cleanse_free_output(GumboOutput *output)
+const rb_data_type_t cleanse_document_type = {
+  "Cleanse::Document",
+  { cleanse_document_mark, cleanse_document_free, NULL, },
+  0, 0,
+  RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+void cleanse_document_free(void *_doc)
 {
-  gumbo_destroy_output(output);
+  CleanseDocument *doc = _doc;
+
+  if (doc->output) {
+    gumbo_destroy_output(doc->output);
+  }
+  xfree(doc);
 }
 
-// Thank you, Internet https://git.io/JtPnH
-VALUE preprocess(VALUE rb_text)
+/*
+ * Parses `input` into `doc`. This never touches the Ruby VM, so it is safe
+ * to run without the GVL; failures are reported through the return value
+ * and must be raised by the caller once the lock has been reacquired.
+ *
+ * Up to `max_errors` parse errors are kept in the output. With 0 the parser
+ * only notes that the document had errors, and never builds the records.
+ *
+ * The tree points straight into `input`, which must outlive `doc`.
+ */
+CleanseParseStatus
+cleanse_parse_fragment(CleanseDocument *doc, const char *input, long input_len,
+                       GumboTag fragment_ctx, int max_errors)
 {
-  char *input = RSTRING_PTR(rb_text);
-  long i, input_len = RSTRING_LEN(rb_text), output_len = 0;
-  char *output = ALLOC_N(char, input_len);
-  VALUE result;
+  GumboOptions options = kGumboDefaultOptions;
+  options.max_errors = max_errors;
+  // Have the tokenizer drop control characters and non-ASCII bytes as it
+  // reads, rather than preprocessing the input into a copy first
+  options.strip_disallowed_bytes = true;
+  // Index markup bytes up front so text and attribute values are lexed a
+  // span at a time
+  options.structural_index = true;
+  // Build the whole tree in one arena, so that it is cheap to allocate and
+  // freeing it doesn't mean walking it
+  options.use_arena = true;
+  // Sanitizing and serializing only need the index-linked compact tree,
+  // which is a fraction of the size of the GumboNodes it's made from
+  options.compact_tree = true;
+  // ...which has no use for line and column numbers or original text,
+  // unless they are wanted for error messages
+  options.skip_source_positions = (max_errors == 0);
+  if (fragment_ctx != GUMBO_TAG_LAST) {
+    options.fragment_context = gumbo_normalized_tagname(fragment_ctx);
+  }
 
-  if (!output) {
-    return Qnil;
+  doc->source_len = input_len;
+  doc->output = gumbo_parse_with_options(&options, input, input_len);
+  if (doc->output->status != GUMBO_STATUS_OK) {
+    return CLEANSE_PARSE_FAILED;
   }
 
-  for(i = 0; i < input_len; ++i) {
-    long remain = input_len - i;
+  return CLEANSE_PARSE_OK;
+}
 
-    /* ASCII, minus DEL */
-    if (input[i] == '\t' ||
-        input[i] == '\r' ||
-        input[i] == '\n' ||
-        input[i] == '\f' ||
-        (input[i] >= ' ' && input[i] < 127)) {
-      output[output_len++] = input[i];
-    }
-    /* 2-byte sequence */
-    else if (remain >= 2 &&
-             (input[i] & 0xe0) == 0xc0 &&
-             (input[i + 1] & 0xc0) == 0x80) {
-      i+=1;
-    }
-    /* 3-byte sequence */
-    else if (remain >= 3 &&
-             (input[i] & 0xf0) == 0xe0 &&
-             (input[i + 1] & 0xc0) == 0x80 &&
-             (input[i + 2] & 0xc0) == 0x80) {
-      i+=2;
-    }
-    /* 4-byte sequence */
-    else if (remain >= 4 &&
-             (input[i] & 0xf8) == 0xf0 &&
-             (input[i + 1] & 0xc0) == 0x80 &&
-             (input[i + 2] & 0xc0) == 0x80 &&
-             (input[i + 3] & 0xc0) == 0x80) {
-      i+=3;
+void cleanse_raise_parse_status(CleanseParseStatus status)
+{
+  switch (status) {
+  case CLEANSE_PARSE_OK:
+    break;
+  case CLEANSE_PARSE_NOMEM:
+    rb_memerror();
+    break;
+  case CLEANSE_PARSE_FAILED:
+    rb_raise(rb_eRuntimeError, "could not parse rb_text");
+    break;
+  }
+}
+
+typedef struct {
+  CleanseDocument *doc;
+  const char *input;
+  long input_len;
+  GumboTag fragment_ctx;
+  int max_errors;
+  const CleanseSanitizerPlan *plan;
+  CleanseParseStatus status;
+} ParseArgs;
+
+static void *parse_and_sanitize_nogvl(void *_args)
+{
+  ParseArgs *args = _args;
+  GumboCompactTree *tree;
+
+  args->status = cleanse_parse_fragment(
+                   args->doc, args->input, args->input_len,
+                   args->fragment_ctx, args->max_errors);
+
+  if (args->status == CLEANSE_PARSE_OK && args->plan) {
+    tree = args->doc->output->compact;
+    if (args->fragment_ctx == GUMBO_TAG_LAST) {
+      cleanse_node_sanitize(args->plan, tree, tree->document);
+    } else {
+      cleanse_node_sanitize(args->plan, tree, tree->root);
     }
   }
 
-  result = rb_str_new(output, output_len);
-  free(output);
-  return result;
+  return NULL;
 }
 
-GumboOutput *cleanse_parse_fragment(VALUE rb_text, GumboTag fragment_ctx)
+/*
+ * Looks up the `sanitizer:` option. When it isn't given at all we sanitize
+ * with the shared, frozen Sanitizer::DEFAULT; an explicit `nil` turns
+ * sanitization off.
+ */
+static VALUE
+sanitizer_from_opts(VALUE rb_opts)
 {
-  GumboOptions options = kGumboDefaultOptions;
-  options.max_errors = 10;
-  if (fragment_ctx != GUMBO_TAG_LAST) {
-    options.fragment_context = gumbo_normalized_tagname(fragment_ctx);
+  VALUE rb_sanitizer = Qundef;
+
+  if (!NIL_P(rb_opts)) {
+    rb_sanitizer = rb_hash_lookup2(rb_opts, CSTR2SYM("sanitizer"), Qundef);
+  }
+
+  if (rb_sanitizer == Qundef) { // sanitize by default!
+    rb_sanitizer = rb_const_get_at(rb_cSanitizer, g_id_default);
+  }
+
+  return rb_sanitizer;
+}
+
+/*
+ * Looks up the `max_errors:` option. Errors aren't collected by default,
+ * which lets the parser skip building them altogether.
+ */
+static int
+max_errors_from_opts(VALUE rb_opts)
+{
+  VALUE rb_max_errors = Qnil;
+  int max_errors;
+
+  if (!NIL_P(rb_opts)) {
+    rb_max_errors = rb_hash_lookup(rb_opts, CSTR2SYM("max_errors"));
+  }
+
+  if (NIL_P(rb_max_errors)) {
+    return 0;
   }
 
-  VALUE rb_clean = preprocess(rb_text);
+  max_errors = NUM2INT(rb_max_errors);
+  if (max_errors < 0) {
+    rb_raise(rb_eArgError, "max_errors must not be negative");
+  }
 
-  return gumbo_parse_with_options(&options, RSTRING_PTR(rb_clean), RSTRING_LEN(rb_clean));
+  return max_errors;
 }
 
-VALUE cleanse_parse_to_rb(VALUE klass, VALUE rb_text, GumboTag fragment_ctx)
+static CleanseSanitizer *
+sanitizer_get_struct(VALUE rb_sanitizer)
 {
-  GumboOutput *output = cleanse_parse_fragment(rb_text, fragment_ctx);
-  if (output->status != GUMBO_STATUS_OK) {
-    rb_raise(rb_eRuntimeError, "could not parse rb_text");
+  CleanseSanitizer *sanitizer = NULL;
+
+  if (!NIL_P(rb_sanitizer)) {
+    if (!rb_obj_is_kind_of(rb_sanitizer, rb_cSanitizer)) {
+      rb_raise(rb_eTypeError, "expected a Cleanse::Sanitizer instance");
+    }
+    TypedData_Get_Struct(rb_sanitizer, CleanseSanitizer, &cleanse_sanitizer_type, sanitizer);
   }
-  return Data_Wrap_Struct(klass, NULL, &cleanse_free_output, output);
+
+  return sanitizer;
+}
+
+typedef struct {
+  void *(*func)(void *);
+  void *data;
+  long work_size;
+  const CleanseSanitizerPlan *plan;
+} PlanRun;
+
+static VALUE
+plan_run_body(VALUE _run)
+{
+  PlanRun *run = (PlanRun *)_run;
+  cleanse_without_gvl(run->func, run->data, run->work_size);
+  return Qnil;
+}
+
+static VALUE
+plan_run_ensure(VALUE _run)
+{
+  PlanRun *run = (PlanRun *)_run;
+  if (run->plan) {
+    cleanse_sanitizer_release_plan(run->plan);
+  }
+  return Qnil;
+}
+
+/*
+ * Runs `func` (without the GVL, for large enough work), having stored the
+ * sanitizer's plan in `*plan` for it. The plan is held by reference until
+ * `func` is done, so another thread changing the sanitizer in the meantime
+ * can't free it from under us.
+ */
+static void
+run_with_plan(CleanseSanitizer *sanitizer, const CleanseSanitizerPlan **plan,
+              void *(*func)(void *), void *data, long work_size)
+{
+  PlanRun run;
+
+  run.func = func;
+  run.data = data;
+  run.work_size = work_size;
+  run.plan = sanitizer ? cleanse_sanitizer_acquire_plan(sanitizer) : NULL;
+  *plan = run.plan;
+
+  rb_ensure(plan_run_body, (VALUE)&run, plan_run_ensure, (VALUE)&run);
 }
 
 static VALUE
 rb_cleanse_parse_and_sanitize(int argc, VALUE *argv, VALUE klass, GumboTag fragment_ctx)
 {
-  VALUE rb_text, rb_sanitizer, rb_sanitizer_config, rb_fragment, rb_opts;
+  VALUE rb_text, rb_sanitizer, rb_fragment, rb_opts;
+  CleanseSanitizer *sanitizer;
+  CleanseDocument *doc;
+  ParseArgs args;
 
   rb_scan_args(argc, argv, "1:", &rb_text, &rb_opts);
 
-  if (!NIL_P(rb_opts)) {
-    rb_sanitizer = rb_hash_lookup(rb_opts, CSTR2SYM("sanitizer"));
-  } else { // sanitize by default!
-    rb_sanitizer_config = rb_const_get_at(rb_mConfig, rb_intern("DEFAULT"));
-    rb_sanitizer = rb_funcall(rb_cSanitizer, rb_intern("new"), 1, rb_sanitizer_config);
-  }
-
+  rb_sanitizer = sanitizer_from_opts(rb_opts);
   strcheck(rb_text);
 
-  rb_fragment = cleanse_parse_to_rb(klass, rb_text, fragment_ctx);
+  sanitizer = sanitizer_get_struct(rb_sanitizer);
+  args.max_errors = max_errors_from_opts(rb_opts);
+
+  // The document may parse in place, so it keeps a frozen view of the input
+  rb_text = rb_str_new_frozen(rb_text);
+  rb_fragment = TypedData_Make_Struct(klass, CleanseDocument, &cleanse_document_type, doc);
+  doc->rb_source = rb_text;
+
+  args.doc = doc;
+  args.input = RSTRING_PTR(rb_text);
+  args.input_len = RSTRING_LEN(rb_text);
+  args.fragment_ctx = fragment_ctx;
+
+  run_with_plan(sanitizer, &args.plan, parse_and_sanitize_nogvl, &args, args.input_len);
+
+  RB_GC_GUARD(rb_text);
+  RB_GC_GUARD(rb_sanitizer);
+
+  cleanse_raise_parse_status(args.status);
 
   rb_ivar_set(rb_fragment, g_id_sanitizer, rb_sanitizer);
-  if (!NIL_P(rb_sanitizer)) {
-    GumboOutput *output = NULL;
-    CleanseSanitizer *sanitizer = NULL;
+  return rb_fragment;
+}
 
-    if (!rb_obj_is_kind_of(rb_sanitizer, rb_cSanitizer)) {
-      rb_raise(rb_eTypeError, "expected a Cleanse::Sanitizer instance");
-    }
+void
+cleanse_sanitize_job_run(CleanseSanitizeJob *job)
+{
+  CleanseDocument doc;
+  GumboTag fragment_ctx = job->fragment ? GUMBO_TAG_DIV : GUMBO_TAG_HTML;
 
-    Data_Get_Struct(rb_fragment, GumboOutput, output);
-    Data_Get_Struct(rb_sanitizer, CleanseSanitizer, sanitizer);
+  strbuf_init(&job->out);
+  job->error = NULL;
+  job->status = cleanse_parse_fragment(&doc, job->input, job->input_len, fragment_ctx, 0);
 
-    if (fragment_ctx == GUMBO_TAG_LAST) {
-      cleanse_node_sanitize(sanitizer, output->document);
-    } else {
-      cleanse_node_sanitize(sanitizer, output->root);
+  if (job->status == CLEANSE_PARSE_OK) {
+    if (job->plan) {
+      cleanse_node_sanitize(job->plan, doc.output->compact, doc.output->compact->root);
     }
+
+    job->error = cleanse_serialize_output(
+                   &job->out, doc.output, job->fragment,
+                   job->plan ? job->plan->allow_doctype : false);
   }
 
-  return rb_fragment;
+  if (doc.output) {
+    gumbo_destroy_output(doc.output);
+  }
+
+  if (job->status != CLEANSE_PARSE_OK || job->error) {
+    strbuf_free(&job->out);
+  }
+}
+
+static void *sanitize_job_nogvl(void *job)
+{
+  cleanse_sanitize_job_run(job);
+  return NULL;
+}
+
+/*
+ * call-seq:
+ *   Cleanse.sanitize(html, sanitizer: nil, fragment: true) -> String
+ *
+ * Parses, sanitizes and serializes `html` in one go, without building a
+ * Document or DocumentFragment. Takes the same `sanitizer:` option as
+ * those; pass `fragment: false` to treat the input as a whole document.
+ */
+static VALUE
+rb_cleanse_sanitize(int argc, VALUE *argv, VALUE rb_self)
+{
+  VALUE rb_text, rb_sanitizer, rb_opts, rb_fragment = Qtrue;
+  CleanseSanitizer *sanitizer;
+  CleanseSanitizeJob job;
+
+  rb_scan_args(argc, argv, "1:", &rb_text, &rb_opts);
+
+  rb_sanitizer = sanitizer_from_opts(rb_opts);
+  if (!NIL_P(rb_opts)) {
+    rb_fragment = rb_hash_lookup2(rb_opts, CSTR2SYM("fragment"), Qtrue);
+  }
+  strcheck(rb_text);
+
+  sanitizer = sanitizer_get_struct(rb_sanitizer);
+  job.fragment = RTEST(rb_fragment);
+
+  rb_text = cleanse_str_for_nogvl(rb_text);
+  job.input = RSTRING_PTR(rb_text);
+  job.input_len = RSTRING_LEN(rb_text);
+
+  run_with_plan(sanitizer, &job.plan, sanitize_job_nogvl, &job, job.input_len);
+
+  RB_GC_GUARD(rb_text);
+  RB_GC_GUARD(rb_sanitizer);
+
+  cleanse_raise_parse_status(job.status);
+  if (job.error) {
+    rb_raise(rb_eRuntimeError, "%s", job.error);
+  }
+
+  return strbuf_to_rb(&job.out, true);
+}
+
+/*
+ * call-seq:
+ *   document.errors -> Array
+ *
+ * The parse errors in the source, as caret diagnostics. Only collected
+ * when the document was created with a positive `max_errors:` option, and
+ * then at most that many; otherwise this is always empty.
+ */
+static VALUE
+rb_cleanse_doc_errors(VALUE rb_self)
+{
+  CleanseDocument *doc;
+  const GumboVector *errors;
+  VALUE rb_errors;
+  unsigned int i;
+
+  TypedData_Get_Struct(rb_self, CleanseDocument, &cleanse_document_type, doc);
+  errors = &doc->output->errors;
+  rb_errors = rb_ary_new_capa(errors->length);
+
+  for (i = 0; i < errors->length; ++i) {
+    char *msg = NULL;
+    size_t msg_len = gumbo_caret_diagnostic_to_string(
+                       errors->data[i], RSTRING_PTR(doc->rb_source),
+                       doc->source_len, &msg);
+    VALUE rb_msg = rb_utf8_str_new(msg, msg_len);
+    free(msg);
+    rb_ary_push(rb_errors, rb_msg);
+  }
+
+  RB_GC_GUARD(doc->rb_source);
+  return rb_errors;
 }
 
 static VALUE
@@ -154,14 +401,22 @@ void Init_cleanse_document(void)
 {
   g_id_sanitizer = rb_intern("@sanitizer");
   g_id_html = rb_intern("html");
+  g_id_default = rb_intern("DEFAULT");
 
   rb_cDocument = rb_define_class_under(rb_mCleanse, "Document", rb_cObject);
+  rb_undef_alloc_func(rb_cDocument);
   rb_define_singleton_method(rb_cDocument, "new", rb_cleanse_doc_parse, -1);
+  rb_define_method(rb_cDocument, "errors", rb_cleanse_doc_errors, 0);
 
   rb_cDocumentFragment = rb_define_class_under(rb_mCleanse, "DocumentFragment", rb_cObject);
+  rb_undef_alloc_func(rb_cDocumentFragment);
   rb_define_singleton_method(rb_cDocumentFragment, "new", rb_cleanse_doc_fragment_parse, -1);
+  rb_define_method(rb_cDocumentFragment, "errors", rb_cleanse_doc_errors, 0);
+
+  rb_define_singleton_method(rb_mCleanse, "sanitize", rb_cleanse_sanitize, -1);
 
   rb_cNode = rb_define_class_under(rb_mCleanse, "Node", rb_cObject);
+  rb_undef_alloc_func(rb_cNode);
   rb_cTextNode = rb_define_class_under(rb_mCleanse, "TextNode", rb_cNode);
   rb_cCommentNode = rb_define_class_under(rb_mCleanse, "CommentNode", rb_cNode);
   rb_cElementNode = rb_define_class_under(rb_mCleanse, "ElementNode", rb_cNode);
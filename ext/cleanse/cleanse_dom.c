@@ -1,91 +1,81 @@
 #include "cleanse.h"
 
 #include "gumbo.h"
-#include "parser.h"
-#include "vector.h"
 
-// TODO
-static GumboNode* create_node(GumboNodeType type)
+/*
+ * Puts the chain of siblings `first`..`last` in the place of `child`,
+ * whose previous sibling is `prev`. An empty chain (`first` is
+ * GUMBO_COMPACT_NONE) just unlinks `child`.
+ */
+static void replace_child(GumboCompactTree *tree, GumboNodeIndex parent,
+                          GumboNodeIndex prev, GumboNodeIndex child,
+                          GumboNodeIndex first, GumboNodeIndex last)
 {
-  GumboNode* node = gumbo_alloc(sizeof(GumboNode));
-  node->parent = NULL;
-  node->index_within_parent = -1;
-  node->type = type;
-  node->parse_flags = GUMBO_INSERTION_NORMAL;
-  return node;
-}
+  GumboCompactNode *nodes = tree->nodes;
+  GumboNodeIndex next = nodes[child].next_sibling;
+  GumboNodeIndex x;
 
-// A node to separate an element that has been sanitized out
-static GumboNode *create_whitespace_node()
-{
-  GumboNode *node = create_node(GUMBO_NODE_WHITESPACE);
-  node->parse_flags = GUMBO_INSERTION_BY_PARSER;
-  node->v.text.text = strdup(" ");
-  node->v.text.start_pos = kGumboEmptySourcePosition;
-  return node;
-}
-
-static void readjust_children(unsigned int pos, GumboVector *children, GumboNode *parent)
-{
-  unsigned int x;
-  for (x = pos; x < children->length; ++x) {
-    GumboNode *child = children->data[x];
-    if (parent) {
-      child->parent = parent;
+  if (first == GUMBO_COMPACT_NONE) {
+    first = next;
+    last = prev;
+  } else {
+    for (x = first; x != next; x = nodes[x].next_sibling) {
+      nodes[x].parent = parent;
+      if (x == last) {
+        nodes[x].next_sibling = next;
+      }
     }
-    child->index_within_parent = x;
   }
+
+  if (prev == GUMBO_COMPACT_NONE) {
+    nodes[parent].first_child = first;
+  } else {
+    nodes[prev].next_sibling = first;
+  }
+
+  if (next == GUMBO_COMPACT_NONE) {
+    nodes[parent].last_child = last;
+  }
+
+  nodes[child].parent = GUMBO_COMPACT_NONE;
+  nodes[child].next_sibling = GUMBO_COMPACT_NONE;
 }
 
 void
-cleanse_remove_child_at(GumboNode *parent, unsigned int pos, bool wrap)
+cleanse_remove_child(GumboCompactTree *tree, GumboNodeIndex parent,
+                     GumboNodeIndex prev, GumboNodeIndex child, bool wrap)
 {
-  GumboVector *children = &parent->v.element.children;
-
   if (wrap) {
-    GumboNode *whitespace_node = create_whitespace_node();
-    whitespace_node->parent = parent;
-    whitespace_node->index_within_parent = pos;
-    children->data[pos] = whitespace_node;
-  } else {
-    gumbo_vector_remove_at(pos, children);
+    // Leave the node where it is, as a space separating its neighbours
+    tree->nodes[child].type = CLEANSE_NODE_SPACER;
+    tree->nodes[child].first_child = GUMBO_COMPACT_NONE;
+    tree->nodes[child].last_child = GUMBO_COMPACT_NONE;
+    return;
   }
 
-  readjust_children(pos, children, NULL);
+  replace_child(tree, parent, prev, child, GUMBO_COMPACT_NONE, GUMBO_COMPACT_NONE);
 }
 
 void
-cleanse_reparent_children_at(GumboNode *parent, GumboVector *new_children,
-                             unsigned int pos, bool wrap)
+cleanse_reparent_children(GumboCompactTree *tree, GumboNodeIndex parent,
+                          GumboNodeIndex prev, GumboNodeIndex child, bool wrap)
 {
-  GumboVector *children = &parent->v.element.children;
-  void **new_children_ary;
-  unsigned int new_children_len;
+  GumboNodeIndex first = tree->nodes[child].first_child;
+  GumboNodeIndex last = tree->nodes[child].last_child;
 
-  if (!new_children->length) {
-    cleanse_remove_child_at(parent, pos, wrap);
+  if (first == GUMBO_COMPACT_NONE) {
+    cleanse_remove_child(tree, parent, prev, child, wrap);
     return;
   }
 
   if (wrap) {
-    new_children_len = new_children->length + 2;
-    new_children_ary = alloca(new_children_len * sizeof(void*));
-    memcpy(new_children_ary + 1,
-           new_children->data,
-           new_children->length * sizeof(void *));
-    new_children_ary[0] = create_whitespace_node();
-    new_children_ary[new_children_len - 1] = create_whitespace_node();
-  } else {
-    new_children_len = new_children->length;
-    new_children_ary = new_children->data;
+    // Keep the children where they are, in a node that puts spaces around
+    // them rather than tags
+    tree->nodes[child].type = CLEANSE_NODE_SPACED;
+    return;
   }
 
-  gumbo_vector_splice(
-    pos, 1, new_children_ary, new_children_len,
-    children);
-
-  readjust_children(pos, children, parent);
-
-  new_children->length = 0;
+  tree->nodes[child].first_child = GUMBO_COMPACT_NONE;
+  tree->nodes[child].last_child = GUMBO_COMPACT_NONE;
+  replace_child(tree, parent, prev, child, first, last);
 }
-
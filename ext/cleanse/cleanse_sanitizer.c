@@ -8,13 +8,16 @@
 #include "vector.h"
 #include "string_set.h"
 
+/*
+ * Per-run traversal state. This is kept off the Ruby heap so sanitizing
+ * can run on threads that don't hold the GVL (or aren't Ruby threads).
+ */
 typedef struct {
-  st_table *tags_visited;
+  /* How many of each tag enclose the current node; only kept up for tags
+   * with a max_nested limit. */
+  uint32_t depth_by_tag[GUMBO_TAG_LAST];
 } context;
 
-static void
-sanitize_node(const CleanseSanitizer *sanitizer, context *ctx, GumboNode *node);
-
 static int
 free_each_element_sanitizer(st_data_t _unused1, st_data_t _ef, st_data_t _unused2)
 {
@@ -45,6 +48,9 @@ cleanse_sanitizer_free(void *_sanitizer)
 {
   CleanseSanitizer *sanitizer = _sanitizer;
 
+  if (sanitizer->plan) {
+    cleanse_sanitizer_release_plan(sanitizer->plan);
+  }
   string_set_free(&sanitizer->attr_allowed);
   string_set_free(&sanitizer->class_allowed);
 
@@ -62,10 +68,295 @@ cleanse_sanitizer_new(void)
   string_set_new(&sanitizer->attr_allowed);
   string_set_new(&sanitizer->class_allowed);
   sanitizer->element_sanitizers = st_init_numtable();
+  sanitizer->plan_state = CLEANSE_PLAN_STALE;
 
   return sanitizer;
 }
 
+static void
+plan_free(CleanseSanitizerPlan *plan)
+{
+  uint32_t i;
+
+  for (i = 0; i < plan->allowlist_count; ++i) {
+    string_index_free(&plan->allowlists[i]);
+  }
+  xfree(plan->allowlists);
+  string_index_free(&plan->attr_names);
+  xfree(plan->bitsets);
+  xfree(plan->protocols);
+  xfree(plan);
+}
+
+/*
+ * Drops a reference to a plan, freeing it once nothing holds one. Call with
+ * the GVL held. A plan shared between Ractors may be released under
+ * several of their locks at once, hence the atomic count.
+ */
+void
+cleanse_sanitizer_release_plan(const CleanseSanitizerPlan *_plan)
+{
+  CleanseSanitizerPlan *plan = (CleanseSanitizerPlan *)_plan;
+
+  if (__atomic_sub_fetch(&plan->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+    plan_free(plan);
+  }
+}
+
+static void
+add_attr_names(string_set_t *names, const string_set_t *set)
+{
+  uint32_t i;
+
+  for (i = 0; i < set->allocated; ++i) {
+    // "*" in a required list means "any attribute", not an attribute name
+    if (set->strings[i] && strcmp(set->strings[i], "*")) {
+      string_set_add(names, set->strings[i]);
+    }
+  }
+}
+
+static int
+collect_element_attr_names(st_data_t _unused, st_data_t _ef, st_data_t _names)
+{
+  CleanseElementSanitizer *ef = (CleanseElementSanitizer *)_ef;
+  string_set_t *names = (string_set_t *)_names;
+  CleanseProtocolSanitizer *proto;
+  (void)_unused;
+
+  add_attr_names(names, &ef->attr_allowed);
+  add_attr_names(names, &ef->attr_required);
+  for (proto = ef->protocols; proto; proto = proto->next) {
+    string_set_add(names, proto->name);
+  }
+
+  return ST_CONTINUE;
+}
+
+typedef struct {
+  CleanseSanitizerPlan *plan;
+  const uint64_t *attr_allowed;
+  uint64_t *next_bitset;
+  CleanseProtocolRule *next_rule;
+} plan_builder;
+
+static const string_index_t *
+freeze_allowlist(CleanseSanitizerPlan *plan, const string_set_t *set)
+{
+  string_index_t *index = &plan->allowlists[plan->allowlist_count++];
+  string_set_freeze(set, index);
+  return index;
+}
+
+static void
+set_attr_bits(const CleanseSanitizerPlan *plan, uint64_t *bitset,
+              const string_set_t *set)
+{
+  uint32_t i;
+
+  for (i = 0; i < set->allocated; ++i) {
+    const char *name = set->strings[i];
+    if (name) {
+      uint32_t attr = string_index_lookup(&plan->attr_names, name, strlen(name));
+      bitset[attr / 64] |= (uint64_t)1 << (attr % 64);
+    }
+  }
+  // Names that aren't attributes, like "*", must not allow unknown ones
+  bitset[0] &= ~(uint64_t)1;
+}
+
+static int
+compile_element(st_data_t _tag, st_data_t _ef, st_data_t _builder)
+{
+  CleanseElementSanitizer *ef = (CleanseElementSanitizer *)_ef;
+  plan_builder *builder = (plan_builder *)_builder;
+  CleanseSanitizerPlan *plan = builder->plan;
+  CleanseElementPolicy *policy = &plan->elements[(GumboTag)_tag];
+  CleanseProtocolSanitizer *proto;
+  uint32_t words = plan->attr_words, i;
+  uint64_t *allowed = builder->next_bitset;
+  uint64_t *required = allowed + words;
+  uint64_t *protocols = required + words;
+
+  builder->next_bitset += 3 * words;
+
+  set_attr_bits(plan, allowed, &ef->attr_allowed);
+  for (i = 0; i < words; ++i) {
+    allowed[i] |= builder->attr_allowed[i];
+  }
+  policy->attr_allowed = allowed;
+
+  if (ef->attr_required.size) {
+    set_attr_bits(plan, required, &ef->attr_required);
+    policy->attr_required = required;
+    policy->require_any = string_set_contains(&ef->attr_required, "*");
+  }
+
+  policy->attr_protocols = protocols;
+  policy->protocols = builder->next_rule;
+  for (proto = ef->protocols; proto; proto = proto->next) {
+    CleanseProtocolRule *rule = builder->next_rule++;
+    rule->attr = string_index_lookup(&plan->attr_names, proto->name,
+                                     strlen(proto->name));
+    rule->allowed = freeze_allowlist(plan, &proto->allowed);
+    protocols[rule->attr / 64] |= (uint64_t)1 << (rule->attr % 64);
+    policy->protocol_count++;
+  }
+
+  policy->max_nested = ef->max_nested;
+  if (ef->class_allowed.size) {
+    policy->class_allowed = freeze_allowlist(plan, &ef->class_allowed);
+  }
+
+  return ST_CONTINUE;
+}
+
+static int
+count_protocol_rules(st_data_t _unused, st_data_t _ef, st_data_t _count)
+{
+  CleanseElementSanitizer *ef = (CleanseElementSanitizer *)_ef;
+  CleanseProtocolSanitizer *proto;
+  (void)_unused;
+
+  for (proto = ef->protocols; proto; proto = proto->next) {
+    ++*(size_t *)_count;
+  }
+
+  return ST_CONTINUE;
+}
+
+/*
+ * Compiles the sanitizer's current settings into a new plan, holding one
+ * reference for the caller.
+ */
+static CleanseSanitizerPlan *
+plan_build(const CleanseSanitizer *sanitizer)
+{
+  CleanseSanitizerPlan *plan;
+  plan_builder builder;
+  string_set_t names;
+  const char **name_list;
+  size_t protocol_rules = 0, bitsets;
+  uint32_t i, count = 0;
+  uint64_t *attr_allowed;
+  int tag;
+
+  plan = xcalloc(1, sizeof(CleanseSanitizerPlan));
+  plan->refcount = 1;
+  plan->allow_comments = sanitizer->allow_comments;
+  plan->allow_doctype = sanitizer->allow_doctype;
+
+  string_set_new(&names);
+  add_attr_names(&names, &sanitizer->attr_allowed);
+  st_foreach(sanitizer->element_sanitizers, &collect_element_attr_names,
+             (st_data_t)&names);
+
+  name_list = xmalloc((names.size ? names.size : 1) * sizeof(char *));
+  for (i = 0; i < names.allocated; ++i) {
+    if (names.strings[i]) {
+      name_list[count++] = names.strings[i];
+    }
+  }
+  string_index_build(&plan->attr_names, name_list, count);
+  xfree(name_list);
+  string_set_free(&names);
+
+  // Attribute 0 stands for every name not in the index
+  plan->attr_words = (count + 1 + 63) / 64;
+  plan->class_attr = string_index_lookup(&plan->attr_names, "class", 5);
+  plan->charset_attr = string_index_lookup(&plan->attr_names, "charset", 7);
+
+  st_foreach(sanitizer->element_sanitizers, &count_protocol_rules,
+             (st_data_t)&protocol_rules);
+  plan->allowlists = xmalloc((1 + sanitizer->element_sanitizers->num_entries +
+                              protocol_rules) * sizeof(string_index_t));
+  if (sanitizer->class_allowed.size) {
+    plan->class_allowed = freeze_allowlist(plan, &sanitizer->class_allowed);
+  }
+  bitsets = 1 + 3 * sanitizer->element_sanitizers->num_entries;
+  plan->bitsets = xcalloc(bitsets * plan->attr_words, sizeof(uint64_t));
+  plan->protocols = xmalloc((protocol_rules ? protocol_rules : 1) *
+                            sizeof(CleanseProtocolRule));
+
+  attr_allowed = plan->bitsets;
+  set_attr_bits(plan, attr_allowed, &sanitizer->attr_allowed);
+
+  for (tag = 0; tag < GUMBO_TAG_LAST; ++tag) {
+    CleanseElementPolicy *policy = &plan->elements[tag];
+    policy->flags = (tag == GUMBO_TAG_UNKNOWN) ? 0 : sanitizer->flags[tag];
+    policy->attr_allowed = attr_allowed;
+  }
+
+  builder.plan = plan;
+  builder.attr_allowed = attr_allowed;
+  builder.next_bitset = plan->bitsets + plan->attr_words;
+  builder.next_rule = plan->protocols;
+  st_foreach(sanitizer->element_sanitizers, &compile_element,
+             (st_data_t)&builder);
+
+  return plan;
+}
+
+/*
+ * Replaces the sanitizer's plan with one compiled from its current
+ * settings. The old plan is never changed, only released, so anything
+ * sanitizing with it carries on undisturbed. Call with the GVL held.
+ */
+static void
+sanitizer_update(CleanseSanitizer *sanitizer)
+{
+  const CleanseSanitizerPlan *old = sanitizer->plan;
+
+  sanitizer->plan = plan_build(sanitizer);
+  __atomic_store_n(&sanitizer->plan_state, CLEANSE_PLAN_CURRENT, __ATOMIC_RELEASE);
+  if (old) {
+    cleanse_sanitizer_release_plan(old);
+  }
+}
+
+/*
+ * Rebuilds the sanitizer's plan if a setter has changed its settings since
+ * it was last built. Only for sanitizers no other Ractor can see.
+ */
+void
+cleanse_sanitizer_compile(CleanseSanitizer *sanitizer)
+{
+  if (sanitizer->plan_state != CLEANSE_PLAN_CURRENT) {
+    sanitizer_update(sanitizer);
+  }
+}
+
+/*
+ * Takes a reference to the sanitizer's plan, rebuilding it first if it is
+ * stale. The plan stays valid (and unchanged) until it is released,
+ * whatever happens to the sanitizer in the meantime. Call with the GVL
+ * held.
+ *
+ * The GVL alone doesn't serialize Ractors, and Ractor.make_shareable can
+ * freeze and share a sanitizer without compiling it. So whoever finds the
+ * plan stale claims the rebuild; anyone else arriving while it runs
+ * sanitizes with a plan of their own rather than wait for it.
+ */
+const CleanseSanitizerPlan *
+cleanse_sanitizer_acquire_plan(CleanseSanitizer *sanitizer)
+{
+  CleanseSanitizerPlan *plan;
+  int state = __atomic_load_n(&sanitizer->plan_state, __ATOMIC_ACQUIRE);
+
+  if (state == CLEANSE_PLAN_STALE &&
+      __atomic_compare_exchange_n(&sanitizer->plan_state, &state,
+                                  CLEANSE_PLAN_BUILDING, false,
+                                  __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+    sanitizer_update(sanitizer);
+  } else if (state != CLEANSE_PLAN_CURRENT) {
+    return plan_build(sanitizer);
+  }
+
+  plan = sanitizer->plan;
+  __atomic_add_fetch(&plan->refcount, 1, __ATOMIC_RELAXED);
+  return plan;
+}
+
 static CleanseElementSanitizer *
 try_find_element(const CleanseSanitizer *sanitizer, GumboTag tag)
 {
@@ -119,33 +410,42 @@ CleanseProtocolSanitizer *cleanse_element_sanitizer_get_proto(
 }
 
 static bool
-sanitize_attributes(const CleanseSanitizer *sanitizer, GumboElement *element);
+sanitize_attributes(const CleanseSanitizerPlan *plan, GumboCompactTree *tree,
+                    GumboNodeIndex node);
 
 static void
-remove_child(GumboNode *parent, GumboNode *child, unsigned int pos, uint8_t flags)
+remove_child(GumboCompactTree *tree, GumboNodeIndex parent, GumboNodeIndex prev,
+             GumboNodeIndex child, uint8_t flags)
 {
   bool wrap_whitespace = (flags & CLEANSE_SANITIZER_WRAP_WS);
 
   if ((flags & CLEANSE_SANITIZER_REMOVE_CONTENTS)) {
-    cleanse_remove_child_at(parent, pos, wrap_whitespace);
+    cleanse_remove_child(tree, parent, prev, child, wrap_whitespace);
   } else {
-    cleanse_reparent_children_at(parent,
-                                 &child->v.element.children, pos, wrap_whitespace);
+    cleanse_reparent_children(tree, parent, prev, child, wrap_whitespace);
   }
+}
 
-  gumbo_destroy_node(child);
+static void
+remove_first_child(GumboCompactTree *tree, GumboNodeIndex parent, bool wrap)
+{
+  GumboNodeIndex first = tree->nodes[parent].first_child;
+
+  if (first != GUMBO_COMPACT_NONE) {
+    cleanse_remove_child(tree, parent, GUMBO_COMPACT_NONE, first, wrap);
+  }
 }
 
 static bool
-try_remove_child(
-  const CleanseSanitizer *sanitizer, GumboNode *parent, GumboNode *child, unsigned int pos)
+try_remove_child(const CleanseSanitizerPlan *plan, GumboCompactTree *tree,
+                 GumboNodeIndex parent, GumboNodeIndex prev, GumboNodeIndex child)
 {
-  if (child->type == GUMBO_NODE_ELEMENT || child->type == GUMBO_NODE_TEMPLATE) {
-    GumboTag tag = child->v.element.tag;
+  uint8_t type = tree->nodes[child].type;
+
+  if (type == GUMBO_NODE_ELEMENT || type == GUMBO_NODE_TEMPLATE) {
+    GumboTag tag = tree->nodes[child].tag;
     bool should_remove = false;
-    uint8_t flags =
-      (tag == GUMBO_TAG_UNKNOWN) ? 0
-      : sanitizer->flags[tag];
+    uint8_t flags = plan->elements[tag].flags;
 
     if ((flags & CLEANSE_SANITIZER_ALLOW) == 0) {
       should_remove = true;
@@ -153,140 +453,165 @@ try_remove_child(
 
     if (!should_remove) {
       // anything in <iframe> must be removed, if it's kept
-      if (tag == GUMBO_TAG_IFRAME && child->v.element.children.length > 0) {
-        cleanse_remove_child_at(child, 0, sanitizer->flags[tag]);
+      if (tag == GUMBO_TAG_IFRAME) {
+        remove_first_child(tree, child, flags);
       }
-      if (!sanitize_attributes(sanitizer, &child->v.element)) {
+      if (!sanitize_attributes(plan, tree, child)) {
         should_remove = true;
       }
     }
 
     if (should_remove) {
       // the contents of these are considered "text node" and must be removed
-      if ((tag == GUMBO_TAG_SCRIPT || tag == GUMBO_TAG_STYLE || tag == GUMBO_TAG_MATH || tag == GUMBO_TAG_SVG) && child->v.element.children.length > 0) {
-        cleanse_remove_child_at(child, 0, sanitizer->flags[tag]);
+      if (tag == GUMBO_TAG_SCRIPT || tag == GUMBO_TAG_STYLE || tag == GUMBO_TAG_MATH || tag == GUMBO_TAG_SVG) {
+        remove_first_child(tree, child, flags);
       }
 
-      remove_child(parent, child, pos, flags);
+      remove_child(tree, parent, prev, child, flags);
       return true;
     }
-  } else if (child->type == GUMBO_NODE_COMMENT && !sanitizer->allow_comments) {
-    cleanse_remove_child_at(parent, pos, false);
-    gumbo_destroy_node(child);
+  } else if (type == GUMBO_NODE_COMMENT && !plan->allow_comments) {
+    cleanse_remove_child(tree, parent, prev, child, false);
     return true;
   }
 
   return false;
 }
 
+static bool
+is_container(uint8_t type)
+{
+  return type == GUMBO_NODE_DOCUMENT || type == GUMBO_NODE_ELEMENT ||
+         type == GUMBO_NODE_TEMPLATE || type == CLEANSE_NODE_SPACED;
+}
+
+/*
+ * Sanitizes everything below `root`, depth first. Rather than recursing, the
+ * walk climbs back up through the nodes' parent links, so that a deeply
+ * nested document can't exhaust the C stack. An element unwrapped with
+ * whitespace around it is left in place as a spaced node, and its children
+ * are walked as if they were its parent's.
+ */
 static void
-sanitize_children(const CleanseSanitizer *sanitizer, context *ctx, GumboNode *parent, GumboVector *children)
+sanitize_subtree(const CleanseSanitizerPlan *plan, context *ctx,
+                 GumboCompactTree *tree, GumboNodeIndex root)
 {
-  unsigned int x;
-
-  for (x = 0; x < children->length; ++x) {
-    GumboNode *child = children->data[x];
-    GumboTag tag = GUMBO_TAG_LAST;
-    st_data_t tag_key = GUMBO_TAG_LAST, n = 0;
-
-    if (child->type == GUMBO_NODE_ELEMENT || child->type == GUMBO_NODE_TEMPLATE) {
-      tag = child->v.element.tag;
-      tag_key = (st_data_t)tag;
-
-      CleanseElementSanitizer *ef = try_find_element(sanitizer, tag);
-      if (ef && ef->max_nested > 0 &&
-          st_lookup(ctx->tags_visited, tag_key, (st_data_t *)&n) &&
-          n >= ef->max_nested) {
-        remove_child(parent, child, x, (tag == GUMBO_TAG_UNKNOWN) ? 0 : sanitizer->flags[tag]);
-        x--;
+  const CleanseElementPolicy *policies = plan->elements;
+  GumboNodeIndex parent = root;
+  GumboNodeIndex prev = GUMBO_COMPACT_NONE;
+  GumboNodeIndex child;
+
+  if (!is_container(tree->nodes[root].type)) {
+    return;
+  }
+
+  child = tree->nodes[root].first_child;
+  for (;;) {
+    while (child != GUMBO_COMPACT_NONE) {
+      uint8_t type = tree->nodes[child].type;
+      const CleanseElementPolicy *policy = NULL;
+      bool removed = false;
+
+      if (type == GUMBO_NODE_ELEMENT || type == GUMBO_NODE_TEMPLATE) {
+        policy = &policies[tree->nodes[child].tag];
+        if (policy->max_nested > 0 &&
+            ctx->depth_by_tag[tree->nodes[child].tag] >= policy->max_nested) {
+          remove_child(tree, parent, prev, child, policy->flags);
+          removed = true;
+        }
+      }
+
+      if (removed || try_remove_child(plan, tree, parent, prev, child)) {
+        // Carry on with whatever took the removed node's place
+        child = (prev == GUMBO_COMPACT_NONE)
+                ? tree->nodes[parent].first_child
+                : tree->nodes[prev].next_sibling;
         continue;
       }
-    }
 
-    if (try_remove_child(sanitizer, parent, child, x)) {
-      x--;
-      continue;
-    }
+      if (policy || type == CLEANSE_NODE_SPACED) {
+        if (policy && policy->max_nested > 0) {
+          ctx->depth_by_tag[tree->nodes[child].tag]++;
+        }
+        parent = child;
+        prev = GUMBO_COMPACT_NONE;
+        child = tree->nodes[child].first_child;
+        continue;
+      }
 
-    if (tag_key != GUMBO_TAG_LAST) {
-      n += 1;
-      st_insert(ctx->tags_visited, tag_key, (st_data_t)n);
+      prev = child;
+      child = tree->nodes[child].next_sibling;
     }
 
-    sanitize_node(sanitizer, ctx, child);
+    if (parent == root) {
+      break;
+    }
 
-    if (tag_key != GUMBO_TAG_LAST) {
-      n -= 1;
-      if (n == 0) {
-        st_delete(ctx->tags_visited, &tag_key, NULL);
-      } else {
-        st_insert(ctx->tags_visited, tag_key, (st_data_t)n);
-      }
+    // Done with `parent`'s children: move on to its next sibling
+    if (tree->nodes[parent].type != CLEANSE_NODE_SPACED &&
+        policies[tree->nodes[parent].tag].max_nested > 0) {
+      ctx->depth_by_tag[tree->nodes[parent].tag]--;
     }
+    prev = parent;
+    child = tree->nodes[parent].next_sibling;
+    parent = tree->nodes[parent].parent;
   }
 }
 
 static bool
-has_allowed_protocol(const string_set_t *protocols_allowed, GumboAttribute *attr)
+has_allowed_protocol(const string_index_t *protocols_allowed,
+                     const GumboCompactTree *tree, GumboCompactAttribute *attr)
 {
-  const char *value = attr->value;
+  const char *value = gumbo_compact_text(tree, attr->value);
   char *proto;
   long i, len = 0;
 
   // Trim leading space
-  while (isspace(*value)) {
+  while (attr->value.length && isspace(*value)) {
     value++;
+    attr->value.offset++;
+    attr->value.length--;
   }
 
-  while (value[len] && value[len] != '/' && value[len] != ':' && value[len] != '#') {
+  // The value may be a slice of the input, so it isn't NUL-terminated
+  while (len < attr->value.length &&
+         value[len] != '/' && value[len] != ':' && value[len] != '#') {
     len++;
   }
 
-  attr->value = strdup(value);
-
-  if (value[len] == '\0' || value[len] == '/') {
-    return string_set_contains(protocols_allowed, "/");
+  if (len == attr->value.length || value[len] == '/') {
+    return string_index_lookup(protocols_allowed, "/", 1) != 0;
   }
 
-  if (value[len] == '\0' || value[len] == '#') {
-    return string_set_contains(protocols_allowed, "#");
+  if (value[len] == '#') {
+    return string_index_lookup(protocols_allowed, "#", 1) != 0;
   }
 
   // Make the protocol name case insensitive
-  proto = alloca(len + 1);
+  proto = alloca(len);
   for (i = 0; i < len; ++i) {
     proto[i] = gumbo_tolower(value[i]);
   }
-  proto[len] = 0;
 
-  return string_set_contains(protocols_allowed, proto);
+  return string_index_lookup(protocols_allowed, proto, len) != 0;
 }
 
 static bool
-sanitize_class_attribute(const CleanseSanitizer *sanitizer,
-                         const CleanseElementSanitizer *element_f, GumboAttribute *attr)
+sanitize_class_attribute(const string_index_t *allowed_global,
+                         const string_index_t *allowed_local,
+                         GumboCompactTree *tree, GumboCompactAttribute *attr)
 {
-  const string_set_t *allowed_global = NULL;
-  const string_set_t *allowed_local = NULL;
   GumboStringBuffer buf;
   int valid_classes = 0;
-  char *value, *end;
-
-  if (sanitizer->class_allowed.size) {
-    allowed_global = &sanitizer->class_allowed;
-  }
-
-  if (element_f && element_f->class_allowed.size) {
-    allowed_local = &element_f->class_allowed;
-  }
+  const char *value, *end;
 
   // everything goes through
   if (!allowed_global && !allowed_local) {
     return true;
   }
 
-  value = (char *)attr->value;
-  end = value + strlen(value);
+  value = gumbo_compact_text(tree, attr->value);
+  end = value + attr->value.length;
 
   while (value < end) {
     while (value < end && isspace(*value)) {
@@ -294,21 +619,22 @@ sanitize_class_attribute(const CleanseSanitizer *sanitizer,
     }
 
     if (value < end) {
-      char *class = value;
+      const char *class = value;
+      size_t class_len;
       bool allowed = false;
       while (value < end && !isspace(*value)) {
         value++;
       }
 
-      *value = 0;
+      class_len = value - class;
 
       if (allowed_local &&
-          string_set_contains(allowed_local, class)) {
+          string_index_lookup(allowed_local, class, class_len)) {
         allowed = true;
       }
 
       if (allowed_global &&
-          string_set_contains(allowed_global, class)) {
+          string_index_lookup(allowed_global, class, class_len)) {
         allowed = true;
       }
 
@@ -319,19 +645,16 @@ sanitize_class_attribute(const CleanseSanitizer *sanitizer,
           strbuf_puts(&buf, " ");
         }
 
-        strbuf_puts(&buf, class);
+        strbuf_put(&buf, class, class_len);
         valid_classes++;
       }
-
-      value = value + 1;
     }
   }
 
   /* If we've found classes that passed the allow list,
    * we need to set the new value in the attribute */
   if (valid_classes) {
-    strbuf_put(&buf, "\0", 1);
-    gumbo_attribute_set_value(attr, buf.data);
+    attr->value = gumbo_compact_add_text(tree, buf.data, buf.length);
     strbuf_free(&buf);
     return true;
   }
@@ -340,38 +663,31 @@ sanitize_class_attribute(const CleanseSanitizer *sanitizer,
 }
 
 static bool
-should_keep_attribute(const CleanseSanitizer *sanitizer,
-                      const CleanseElementSanitizer *element_f, GumboAttribute *attr)
+should_keep_attribute(const CleanseSanitizerPlan *plan,
+                      const CleanseElementPolicy *policy,
+                      GumboCompactTree *tree, GumboCompactAttribute *attr,
+                      uint32_t attr_id)
 {
-  bool allowed = false;
-
-  if (element_f && string_set_contains(&element_f->attr_allowed, attr->name)) {
-    allowed = true;
-  }
-
-  if (!allowed && string_set_contains(&sanitizer->attr_allowed, attr->name)) {
-    allowed = true;
-  }
-
-  if (!allowed) {
+  if (!cleanse_attr_in(policy->attr_allowed, attr_id)) {
     return false;
   }
 
-  if (element_f && element_f->protocols) {
-    CleanseProtocolSanitizer *proto = element_f->protocols;
-    while (proto) {
-      if (!strcmp(attr->name, proto->name)) {
-        if (!has_allowed_protocol(&proto->allowed, attr)) {
+  if (policy->protocol_count &&
+      cleanse_attr_in(policy->attr_protocols, attr_id)) {
+    uint32_t i;
+    for (i = 0; i < policy->protocol_count; ++i) {
+      if (policy->protocols[i].attr == attr_id) {
+        if (!has_allowed_protocol(policy->protocols[i].allowed, tree, attr)) {
           return false;
         }
         break;
       }
-      proto = proto->next;
     }
   }
 
-  if (!strcmp(attr->name, "class")) {
-    if (!sanitize_class_attribute(sanitizer, element_f, attr)) {
+  if (attr_id == plan->class_attr) {
+    if (!sanitize_class_attribute(plan->class_allowed, policy->class_allowed,
+                                  tree, attr)) {
       return false;
     }
   }
@@ -380,77 +696,67 @@ should_keep_attribute(const CleanseSanitizer *sanitizer,
 }
 
 static bool
-sanitize_attributes(const CleanseSanitizer *sanitizer, GumboElement *element)
+sanitize_attributes(const CleanseSanitizerPlan *plan, GumboCompactTree *tree,
+                    GumboNodeIndex node)
 {
-  GumboVector *attributes = &element->attributes;
-  CleanseElementSanitizer *element_f = try_find_element(sanitizer, element->tag);
-  unsigned int x;
-
-  for (x = 0; x < attributes->length; ++x) {
-    GumboAttribute *attr = attributes->data[x];
-
-    if (!should_keep_attribute(sanitizer, element_f, attr)) {
-      gumbo_element_remove_attribute_at(element, x);
-      x--;
+  GumboCompactNode *element = &tree->nodes[node];
+  GumboCompactAttribute *attributes = &tree->attributes[element->first_attribute];
+  const CleanseElementPolicy *policy = &plan->elements[element->tag];
+  bool has_required = false;
+  unsigned int x, kept = 0;
+
+  // Compact the kept attributes towards the front as we go, rather than
+  // shifting the rest down for each one that is dropped
+  for (x = 0; x < element->attribute_count; ++x) {
+    GumboCompactAttribute *attr = &attributes[x];
+    uint32_t attr_id = string_index_lookup(&plan->attr_names,
+                                           gumbo_compact_text(tree, attr->name),
+                                           attr->name.length);
+
+    if (!should_keep_attribute(plan, policy, tree, attr, attr_id)) {
       continue;
-    } else {
-      // Prevent the use of `<meta>` elements that set a charset other than UTF-8,
-      // since output is always UTF-8.
-      if (element->tag == GUMBO_TAG_META) {
-        if (!strcmp(attr->name, "charset") && strcmp(attr->value, "utf-8")) {
-          gumbo_attribute_set_value(attr, "utf-8");
-        }
-      }
     }
-  }
-
-  if (element_f && element_f->attr_required.size) {
-    string_set_t *required = &element_f->attr_required;
 
-    if (string_set_contains(required, "*")) {
-      return attributes->length > 0;
+    // Prevent the use of `<meta>` elements that set a charset other than UTF-8,
+    // since output is always UTF-8.
+    if (element->tag == GUMBO_TAG_META) {
+      if (attr_id == plan->charset_attr &&
+          (attr->value.length != 5 ||
+           memcmp(gumbo_compact_text(tree, attr->value), "utf-8", 5))) {
+        attr->value = gumbo_compact_add_text(tree, "utf-8", 5);
+      }
     }
 
-    for (x = 0; x < attributes->length; ++x) {
-      GumboAttribute *attr = attributes->data[x];
-      if (string_set_contains(required, attr->name)) {
-        return true;
-      }
+    if (policy->attr_required &&
+        cleanse_attr_in(policy->attr_required, attr_id)) {
+      has_required = true;
     }
 
-    return false;
+    attributes[kept++] = *attr;
   }
+  element->attribute_count = kept;
 
-  return true;
-}
+  if (policy->attr_required) {
+    if (policy->require_any) {
+      return element->attribute_count > 0;
+    }
 
-static void
-sanitize_node(const CleanseSanitizer *sanitizer, context *ctx, GumboNode *node)
-{
-  switch (node->type) {
-  case GUMBO_NODE_DOCUMENT:
-    sanitize_children(sanitizer, ctx, node, &node->v.document.children);
-    break;
-
-  case GUMBO_NODE_ELEMENT:
-  case GUMBO_NODE_TEMPLATE:
-    sanitize_children(sanitizer, ctx, node, &node->v.element.children);
-    break;
-
-  // Nothing else to sanitize
-  case GUMBO_NODE_TEXT:
-  case GUMBO_NODE_WHITESPACE:
-  case GUMBO_NODE_CDATA:
-  case GUMBO_NODE_COMMENT:
-    break;
+    return has_required;
   }
+
+  return true;
 }
 
+/*
+ * Sanitizes the subtree at `node` in place. Removed nodes are unlinked but
+ * stay in the tree's node array until the tree is destroyed.
+ */
 void
-cleanse_node_sanitize(const CleanseSanitizer *sanitizer, GumboNode *node)
+cleanse_node_sanitize(const CleanseSanitizerPlan *plan, GumboCompactTree *tree,
+                      GumboNodeIndex node)
 {
   context ctx;
-  ctx.tags_visited = st_init_numtable();
-  sanitize_node(sanitizer, &ctx, node);
-  st_free_table(ctx.tags_visited);
+
+  memset(&ctx, 0, sizeof(ctx));
+  sanitize_subtree(plan, &ctx, tree, node);
 }
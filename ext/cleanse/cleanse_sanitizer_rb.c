@@ -6,15 +6,31 @@ VALUE rb_cSanitizer;
 VALUE rb_mConfig;
 ID rb_cleanse_id_relative;
 
+/*
+ * A frozen Sanitizer is read-only from C as well (every setter checks for
+ * frozenness, and freezing compiles its plan), so it may be shared between
+ * Ractors. One frozen without #freeze, as Ractor.make_shareable does, is
+ * compiled by whichever Ractor uses it first; see
+ * cleanse_sanitizer_acquire_plan.
+ */
+const rb_data_type_t cleanse_sanitizer_type = {
+  "Cleanse::Sanitizer",
+  { NULL, cleanse_sanitizer_free, NULL, },
+  0, 0,
+  RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_FROZEN_SHAREABLE,
+};
+
 static VALUE
 rb_cleanse_sanitizer_set_flag(VALUE rb_self,
                               VALUE rb_element, VALUE rb_flag, VALUE rb_bool)
 {
   CleanseSanitizer *sanitizer;
-  Data_Get_Struct(rb_self, CleanseSanitizer, sanitizer);
+  rb_check_frozen(rb_self);
+  TypedData_Get_Struct(rb_self, CleanseSanitizer, &cleanse_sanitizer_type, sanitizer);
   Check_Type(rb_flag, T_FIXNUM);
   cleanse_set_element_flags(sanitizer->flags, rb_element,
                             RTEST(rb_bool), FIX2INT(rb_flag));
+  sanitizer->plan_state = CLEANSE_PLAN_STALE;
   return Qnil;
 }
 
@@ -24,7 +40,8 @@ rb_cleanse_sanitizer_set_all_flags(VALUE rb_self, VALUE rb_flag, VALUE rb_bool)
   long i;
   uint8_t flag;
   CleanseSanitizer *sanitizer;
-  Data_Get_Struct(rb_self, CleanseSanitizer, sanitizer);
+  rb_check_frozen(rb_self);
+  TypedData_Get_Struct(rb_self, CleanseSanitizer, &cleanse_sanitizer_type, sanitizer);
 
   Check_Type(rb_flag, T_FIXNUM);
   flag = FIX2INT(rb_flag);
@@ -38,6 +55,7 @@ rb_cleanse_sanitizer_set_all_flags(VALUE rb_self, VALUE rb_flag, VALUE rb_bool)
       sanitizer->flags[i] &= ~flag;
     }
   }
+  sanitizer->plan_state = CLEANSE_PLAN_STALE;
   return Qnil;
 }
 
@@ -50,7 +68,8 @@ rb_cleanse_sanitizer_allowed_protocols(VALUE rb_self,
   CleanseProtocolSanitizer *proto_f = NULL;
   long i;
 
-  Data_Get_Struct(rb_self, CleanseSanitizer, sanitizer);
+  rb_check_frozen(rb_self);
+  TypedData_Get_Struct(rb_self, CleanseSanitizer, &cleanse_sanitizer_type, sanitizer);
   element_f = cleanse_sanitizer_get_element(sanitizer,
               cleanse_rb_to_gumbo_tag(rb_element));
 
@@ -75,6 +94,7 @@ rb_cleanse_sanitizer_allowed_protocols(VALUE rb_self,
 
     string_set_add(&proto_f->allowed, protocol);
   }
+  sanitizer->plan_state = CLEANSE_PLAN_STALE;
   return Qnil;
 }
 
@@ -82,8 +102,10 @@ static VALUE
 rb_cleanse_sanitizer_set_allow_comments(VALUE rb_self, VALUE rb_bool)
 {
   CleanseSanitizer *sanitizer;
-  Data_Get_Struct(rb_self, CleanseSanitizer, sanitizer);
+  rb_check_frozen(rb_self);
+  TypedData_Get_Struct(rb_self, CleanseSanitizer, &cleanse_sanitizer_type, sanitizer);
   sanitizer->allow_comments = RTEST(rb_bool);
+  sanitizer->plan_state = CLEANSE_PLAN_STALE;
   return rb_bool;
 }
 
@@ -91,8 +113,10 @@ static VALUE
 rb_cleanse_sanitizer_set_allow_doctype(VALUE rb_self, VALUE rb_bool)
 {
   CleanseSanitizer *sanitizer;
-  Data_Get_Struct(rb_self, CleanseSanitizer, sanitizer);
+  rb_check_frozen(rb_self);
+  TypedData_Get_Struct(rb_self, CleanseSanitizer, &cleanse_sanitizer_type, sanitizer);
   sanitizer->allow_doctype = RTEST(rb_bool);
+  sanitizer->plan_state = CLEANSE_PLAN_STALE;
   return rb_bool;
 }
 
@@ -114,7 +138,8 @@ rb_cleanse_sanitizer_allowed_attribute(VALUE rb_self,
   CleanseSanitizer *sanitizer;
   string_set_t *set = NULL;
 
-  Data_Get_Struct(rb_self, CleanseSanitizer, sanitizer);
+  rb_check_frozen(rb_self);
+  TypedData_Get_Struct(rb_self, CleanseSanitizer, &cleanse_sanitizer_type, sanitizer);
 
   if (rb_elem == CSTR2SYM("all")) {
     set = &sanitizer->attr_allowed;
@@ -125,6 +150,7 @@ rb_cleanse_sanitizer_allowed_attribute(VALUE rb_self,
   }
 
   set_in_stringset(set, rb_attr, RTEST(rb_allow));
+  sanitizer->plan_state = CLEANSE_PLAN_STALE;
   return Qnil;
 }
 
@@ -135,7 +161,8 @@ rb_cleanse_sanitizer_allowed_class(VALUE rb_self,
   CleanseSanitizer *sanitizer;
   string_set_t *set = NULL;
 
-  Data_Get_Struct(rb_self, CleanseSanitizer, sanitizer);
+  rb_check_frozen(rb_self);
+  TypedData_Get_Struct(rb_self, CleanseSanitizer, &cleanse_sanitizer_type, sanitizer);
 
   if (rb_elem == CSTR2SYM("all")) {
     set = &sanitizer->class_allowed;
@@ -146,16 +173,33 @@ rb_cleanse_sanitizer_allowed_class(VALUE rb_self,
   }
 
   set_in_stringset(set, rb_class, RTEST(rb_allow));
+  sanitizer->plan_state = CLEANSE_PLAN_STALE;
   return Qnil;
 }
 
+/*
+ * Compiles the current settings into the tables used for sanitizing, if
+ * they changed since the last time. Otherwise this happens when the
+ * sanitizer is next used, so calling it only moves that cost up front.
+ */
+static VALUE
+rb_cleanse_sanitizer_compile(VALUE rb_self)
+{
+  CleanseSanitizer *sanitizer;
+  rb_check_frozen(rb_self);
+  TypedData_Get_Struct(rb_self, CleanseSanitizer, &cleanse_sanitizer_type, sanitizer);
+  cleanse_sanitizer_compile(sanitizer);
+  return rb_self;
+}
+
 VALUE
 rb_cleanse_sanitizer_new(VALUE klass, VALUE rb_config)
 {
   CleanseSanitizer *sanitizer = cleanse_sanitizer_new();
-  VALUE rb_sanitizer_obj = Data_Wrap_Struct(klass, NULL, &cleanse_sanitizer_free, sanitizer);
+  VALUE rb_sanitizer_obj = TypedData_Wrap_Struct(klass, &cleanse_sanitizer_type, sanitizer);
 
   rb_funcall(rb_sanitizer_obj, rb_intern("setup"), 1, rb_config);
+  cleanse_sanitizer_compile(sanitizer);
 
   return rb_sanitizer_obj;
 }
@@ -165,10 +209,13 @@ void Init_cleanse_sanitizer(void)
   rb_cleanse_id_relative = rb_intern("relative");
 
   rb_cSanitizer = rb_define_class_under(rb_mCleanse, "Sanitizer", rb_cObject);
+  rb_undef_alloc_func(rb_cSanitizer);
   rb_mConfig = rb_define_module_under(rb_cSanitizer, "Config");
 
   rb_define_singleton_method(rb_cSanitizer, "new", rb_cleanse_sanitizer_new, 1);
 
+  rb_define_method(rb_cSanitizer, "compile", rb_cleanse_sanitizer_compile, 0);
+
   rb_define_method(rb_cSanitizer, "set_flag", rb_cleanse_sanitizer_set_flag, 3);
   rb_define_method(rb_cSanitizer, "set_all_flags", rb_cleanse_sanitizer_set_all_flags, 2);
 
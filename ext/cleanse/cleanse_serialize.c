@@ -5,46 +5,21 @@
 
 static VALUE rb_cSerializer;
 
-enum {
-  BEFORE_BEGIN = 0,
-  AFTER_BEGIN = 1,
-  BEFORE_END = 2,
-  AFTER_END = 3
-};
-
-typedef struct {
-  VALUE rb_result;
-  VALUE rb_adjacent[4];
-} CleanseReplace;
-
 typedef struct {
   VALUE rb_document;
-  VALUE rb_current_text;
-  GumboStringBuffer current_text;
-  GumboStringBuffer out;
 } CleanseSerializer;
 
-static void
-serialize_node(GumboStringBuffer *out, CleanseSerializer *serial, GumboNode *node);
-
-static GumboTag
-fragment_context_for_node(CleanseSerializer *serial, GumboNode *node)
-{
-  assert(serial);
-
-  if (node->parent && node->parent->type == GUMBO_NODE_DOCUMENT) {
-    GumboOutput *document = DATA_PTR(serial->rb_document);
-    GumboTag tag = document->root->v.element.tag;
-    if (tag != GUMBO_TAG_LAST) {
-      return tag;
-    }
-    // TODO
-    // if (document->fragment_context != GUMBO_TAG_LAST)
-    // return document->fragment_context;
-  }
+/*
+ * State for a single serialization pass. This is filled in without the
+ * GVL held, so errors are recorded here and raised by the caller.
+ */
+typedef struct {
+  const char *error;
+} CleanseSerialization;
 
-  return node->v.element.tag;
-}
+static void
+serialize_node(GumboStringBuffer *out, CleanseSerialization *serial,
+               const GumboCompactTree *tree, GumboNodeIndex index);
 
 void
 cleanse_escape_html(GumboStringBuffer *out, const char *src,
@@ -69,12 +44,15 @@ cleanse_escape_html(GumboStringBuffer *out, const char *src,
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
   };
 
-  static const char *HTML_ESCAPES[] = {
-    "",
-    "&quot;",
-    "&amp;",
-    "&lt;",
-    "&gt;"
+  static const struct {
+    const char *data;
+    size_t length;
+  } HTML_ESCAPES[] = {
+    { "", 0 },
+    { "&quot;", 6 },
+    { "&amp;", 5 },
+    { "&lt;", 4 },
+    { "&gt;", 4 }
   };
 
   long i = 0, org, esc = 0;
@@ -104,301 +82,169 @@ cleanse_escape_html(GumboStringBuffer *out, const char *src,
       continue;
     }
 
-    strbuf_puts(out, HTML_ESCAPES[esc]);
+    strbuf_put(out, HTML_ESCAPES[esc].data, HTML_ESCAPES[esc].length);
   }
 }
 
 
 static void
-cleanse_tag_name_serialize(GumboStringBuffer *out, GumboElement *element)
+cleanse_tag_name_serialize(GumboStringBuffer *out, const GumboCompactTree *tree,
+                           const GumboCompactNode *element)
 {
   assert(element->tag <= GUMBO_TAG_LAST);
 
-  if (element->tag == GUMBO_TAG_UNKNOWN) {
+  if (element->tag == GUMBO_TAG_UNKNOWN && element->text.length) {
     /*
-                 * Gumbo's tokenizer lowercases tag names but then throws them
-                 * away. If they were preserved we wouldn't have to do our own
-                 * lowercasing here.
+     * The tokenizer keeps the lowercased name of unknown tags. Unlike
+     * original_tag, it never includes bytes the tokenizer skipped.
      */
-
-    unsigned int x;
-    GumboStringPiece tag_name = element->original_tag;
-    gumbo_tag_from_original_text(&tag_name);
-
-    gumbo_string_buffer_reserve(out->length + tag_name.length, out);
-    for (x = 0; x < tag_name.length; ++x) {
-      out->data[out->length + x] = gumbo_tolower(tag_name.data[x]);
-    }
-    out->length += tag_name.length;
+    strbuf_put(out, gumbo_compact_text(tree, element->text), element->text.length);
   } else {
-    strbuf_puts(out, gumbo_normalized_tagname(element->tag));
+    strbuf_put(out, gumbo_normalized_tagname(element->tag),
+               gumbo_normalized_tagname_length(element->tag));
   }
 }
 
 static void
-cleanse_start_tag_serialize(GumboStringBuffer *out, GumboElement *element)
+cleanse_start_tag_serialize(GumboStringBuffer *out, const GumboCompactTree *tree,
+                            const GumboCompactNode *element)
 {
-  GumboVector *attributes = &element->attributes;
+  const GumboCompactAttribute *attributes = &tree->attributes[element->first_attribute];
   unsigned int x;
 
   strbuf_put(out, "<", 1);
-  cleanse_tag_name_serialize(out, element);
+  cleanse_tag_name_serialize(out, tree, element);
 
-  for (x = 0; x < attributes->length; ++x) {
-    GumboAttribute *attr = attributes->data[x];
+  for (x = 0; x < element->attribute_count; ++x) {
+    const GumboCompactAttribute *attr = &attributes[x];
 
-    strbuf_putv(out, 3, " ", attr->name, "=\"");
-    cleanse_escape_html(out, attr->value, strlen(attr->value), true);
+    strbuf_put(out, " ", 1);
+    strbuf_put(out, gumbo_compact_text(tree, attr->name), attr->name.length);
+    strbuf_put(out, "=\"", 2);
+    cleanse_escape_html(out, gumbo_compact_text(tree, attr->value), attr->value.length, true);
     strbuf_put(out, "\"", 1);
   }
 
   strbuf_put(out, ">", 1);
 }
 
-static VALUE
-update_current_text(CleanseSerializer *serial, GumboNode *node)
-{
-  GumboStringBuffer *escaped_text = &serial->current_text;
-  VALUE rb_text = serial->rb_current_text;
-
-  strbuf_clear(escaped_text);
-  cleanse_escape_html(escaped_text, node->v.text.text, strlen(node->v.text.text), false);
-
-  DATA_PTR(rb_text) = node;
-  rb_ivar_set(rb_text, g_id_html, strbuf_to_rb(escaped_text, false));
-
-  return rb_text;
-}
-
-static void
-serialize_replacement_node(GumboStringBuffer *out, CleanseSerializer *serial,
-                           GumboNode *node, VALUE rb_adjacent[]);
-
-static void
-process_text_node_1(GumboStringBuffer *out, CleanseSerializer *serial,
-                    long n, GumboNode *node, GumboNode *parent)
-{
-  VALUE rb_result = Qnil;
-  VALUE rb_node = update_current_text(serial, node);
-  CleanseReplace replace = {rb_node, {Qnil, Qnil, Qnil, Qnil}};
-  GumboOutput *replace_with_fragment = NULL;
-  VALUE rb_result_class;
-
-  if (replace.rb_result == Qfalse) {
-    return;
-  }
-
-  if (rb_type(replace.rb_result) == T_STRING) {
-    strcheck(replace.rb_result);
-    replace.rb_result = cleanse_parse_to_rb(
-                          rb_cDocumentFragment, replace.rb_result,
-                          fragment_context_for_node(serial, node->parent));
-  }
-
-  Check_Type(replace.rb_result, T_DATA);
-  rb_result_class = rb_class_of(replace.rb_result);
-
-  /*
-   * Otherwise, check if we got a new Node object,
-   * or a whole document fragment
-   */
-  if (rb_result_class == rb_cElementNode || rb_result_class == rb_cTextNode) {
-    node = DATA_PTR(replace.rb_result);
-  } else if (rb_result_class == rb_cDocumentFragment) {
-    replace_with_fragment = DATA_PTR(replace.rb_result);
-  } else {
-    rb_raise(rb_eTypeError,
-             "Expected a String, Node, or DocumentFragment as replacement "
-             "for the existing node");
-  }
-
-  /*
-   * Iterate through the returned fragment and apply the remaining filters
-   * to each chunk of text in it
-   */
-  if (replace_with_fragment) {
-    unsigned int i;
-    GumboVector *children = &replace_with_fragment->root->v.element.children;
-
-    for (i = 0; i < children->length; ++i) {
-      GumboNode *child = children->data[i];
-      if (child->type == GUMBO_NODE_TEXT) {
-        process_text_node_1(out, serial, n + 1, child, parent);
-      } else {
-        serialize_node(out, NULL, child);
-      }
-    }
-  } else {
-    serialize_replacement_node(out, serial, node, replace.rb_adjacent);
-  }
-}
-
 static void
-process_text_node(GumboStringBuffer *out, CleanseSerializer *serial, GumboNode *node)
+serialize_children(GumboStringBuffer *out, CleanseSerialization *serial,
+                   const GumboCompactTree *tree, GumboNodeIndex parent)
 {
-  process_text_node_1(out, serial, 0, node, node->parent);
-}
+  GumboNodeIndex child;
 
-static void
-serialize_adjacent(GumboStringBuffer *out, VALUE rb_adjacent, GumboTag fragment_ctx)
-{
-  GumboOutput *output;
-  GumboVector *children;
-  unsigned int x;
-
-  strcheck(rb_adjacent);
-
-  output = cleanse_parse_fragment(rb_adjacent, fragment_ctx);
-  children = &output->root->v.element.children;
-
-  for (x = 0; x < children->length; ++x) {
-    serialize_node(out, NULL, children->data[x]);
+  for (child = tree->nodes[parent].first_child; child != GUMBO_COMPACT_NONE;
+       child = tree->nodes[child].next_sibling) {
+    serialize_node(out, serial, tree, child);
   }
-
-  gumbo_destroy_output(output);
 }
 
 static void
-serialize_replacement_element(GumboStringBuffer *out, CleanseSerializer *serial,
-                              GumboNode *node, VALUE rb_adjacent[])
+serialize_element(GumboStringBuffer *out, CleanseSerialization *serial,
+                  const GumboCompactTree *tree, GumboNodeIndex node)
 {
-  GumboElement *element = &node->v.element;
-
-  if (!NIL_P(rb_adjacent[BEFORE_BEGIN])) {
-    serialize_adjacent(
-      out, rb_adjacent[BEFORE_BEGIN],
-      fragment_context_for_node(serial, node->parent));
-  }
+  const GumboCompactNode *element = &tree->nodes[node];
 
-  cleanse_start_tag_serialize(out, element);
+  cleanse_start_tag_serialize(out, tree, element);
 
   if (!element_is_void(element->tag)) {
-    if (node->type != GUMBO_NODE_TEMPLATE) {
-      GumboVector *children = &element->children;
-      unsigned int x;
-
-      if (!NIL_P(rb_adjacent[AFTER_BEGIN])) {
-        serialize_adjacent(out, rb_adjacent[AFTER_BEGIN], element->tag);
-      }
-
-      for (x = 0; x < children->length; ++x) {
-        serialize_node(out, serial, children->data[x]);
-      }
-
-      if (!NIL_P(rb_adjacent[BEFORE_END])) {
-        serialize_adjacent(out, rb_adjacent[BEFORE_END], element->tag);
-      }
+    if (element->type != GUMBO_NODE_TEMPLATE) {
+      serialize_children(out, serial, tree, node);
     }
 
     strbuf_put(out, "</", 2);
-    cleanse_tag_name_serialize(out, element);
+    cleanse_tag_name_serialize(out, tree, element);
     strbuf_put(out, ">", 1);
   }
-
-  if (!NIL_P(rb_adjacent[AFTER_END])) {
-    serialize_adjacent(
-      out, rb_adjacent[AFTER_END],
-      fragment_context_for_node(serial, node->parent));
-  }
 }
 
 static void
-serialize_replacement_node(GumboStringBuffer *out, CleanseSerializer *serial,
-                           GumboNode *node, VALUE rb_adjacent[])
+serialize_node(GumboStringBuffer *out, CleanseSerialization *serial,
+               const GumboCompactTree *tree, GumboNodeIndex index)
 {
+  const GumboCompactNode *node = &tree->nodes[index];
+  const char *text = gumbo_compact_text(tree, node->text);
+
   switch (node->type) {
   case GUMBO_NODE_DOCUMENT:
-    rb_raise(rb_eRuntimeError, "unexpected Document node");
-    break;
-  case GUMBO_NODE_COMMENT:
-    rb_raise(rb_eRuntimeError, "unexpected Comment node");
+    serial->error = "unexpected Document node";
     break;
+
   case GUMBO_NODE_ELEMENT:
   case GUMBO_NODE_TEMPLATE:
-    serialize_replacement_element(out, serial, node, rb_adjacent);
+    serialize_element(out, serial, tree, index);
     break;
-  case GUMBO_NODE_TEXT:
-  case GUMBO_NODE_CDATA:
-  case GUMBO_NODE_WHITESPACE:
-    serialize_node(out, NULL, node);
-    break;
-  }
-}
 
-static void
-serialize_element(GumboStringBuffer *out,
-                  CleanseSerializer *serial, GumboNode *node)
-{
-  CleanseReplace replace = {Qnil, {Qnil, Qnil, Qnil, Qnil}};
-
-  serialize_replacement_node(out, serial, node, replace.rb_adjacent);
-}
-
-static void
-serialize_node(GumboStringBuffer *out, CleanseSerializer *serial, GumboNode *node)
-{
-  switch (node->type) {
-  case GUMBO_NODE_DOCUMENT:
-    rb_raise(rb_eRuntimeError, "unexpected Document node");
+  case GUMBO_NODE_WHITESPACE:
+    strbuf_put(out, text, node->text.length);
     break;
 
-  case GUMBO_NODE_ELEMENT:
-  case GUMBO_NODE_TEMPLATE:
-    serialize_element(out, serial, node);
+  case CLEANSE_NODE_SPACER:
+    strbuf_put(out, " ", 1);
     break;
 
-  case GUMBO_NODE_WHITESPACE: {
-    GumboText *text = &node->v.text;
-    strbuf_puts(out, text->text);
+  case CLEANSE_NODE_SPACED:
+    strbuf_put(out, " ", 1);
+    serialize_children(out, serial, tree, index);
+    strbuf_put(out, " ", 1);
     break;
-  }
 
   case GUMBO_NODE_TEXT:
   case GUMBO_NODE_CDATA: {
-    GumboText *text = &node->v.text;
-    GumboNode *parent = node->parent;
+    const GumboCompactNode *parent = &tree->nodes[node->parent];
+
+    while (parent->type == CLEANSE_NODE_SPACED) {
+      parent = &tree->nodes[parent->parent];
+    }
 
     assert(parent->type == GUMBO_NODE_ELEMENT);
 
-    if (element_is_rcdata(parent->v.element.tag)) {
-      strbuf_puts(out, text->text);
-    } else if (serial) {
-      process_text_node(out, serial, node);
+    if (element_is_rcdata(parent->tag)) {
+      strbuf_put(out, text, node->text.length);
     } else {
-      cleanse_escape_html(out, text->text, strlen(text->text), false);
+      cleanse_escape_html(out, text, node->text.length, false);
     }
     break;
   }
 
-  case GUMBO_NODE_COMMENT: {
-    GumboText *text = &node->v.text;
-    strbuf_putv(out, 3, "<!--", text->text, "-->");
+  case GUMBO_NODE_COMMENT:
+    strbuf_put(out, "<!--", 4);
+    strbuf_put(out, text, node->text.length);
+    strbuf_put(out, "-->", 3);
     break;
-  }
 
   default:
-    rb_raise(rb_eRuntimeError, "unimplemented");
+    serial->error = "unimplemented";
   }
 }
 
+static inline void
+put_text(GumboStringBuffer *out, const GumboCompactTree *tree, GumboTextSpan span)
+{
+  strbuf_put(out, gumbo_compact_text(tree, span), span.length);
+}
+
 static void
-serialize_document(GumboStringBuffer *out, CleanseSerializer *serial,
-                   GumboDocument *document, bool add_doctype)
+serialize_document(GumboStringBuffer *out, CleanseSerialization *serial,
+                   const GumboCompactTree *tree, bool add_doctype)
 {
-  GumboVector *children = &document->children;
-  unsigned int i;
-
-  if (document->has_doctype) {
-    strbuf_putv(out, 2, "<!DOCTYPE ", document->name);
-    if (document->public_identifier && document->public_identifier[0]) {
-      strbuf_putv(out, 3,
-                  " PUBLIC \"", document->public_identifier, "\"");
-      if (document->system_identifier && document->system_identifier[0])
-        strbuf_putv(out, 3,
-                    " \"", document->system_identifier, "\"");
-    } else if (document->system_identifier && document->system_identifier[0]) {
-      strbuf_putv(out, 3,
-                  " SYSTEM \"", document->system_identifier, "\"");
+  if (tree->has_doctype) {
+    strbuf_put(out, "<!DOCTYPE ", 10);
+    put_text(out, tree, tree->doctype_name);
+    if (tree->public_identifier.length) {
+      strbuf_put(out, " PUBLIC \"", 9);
+      put_text(out, tree, tree->public_identifier);
+      strbuf_put(out, "\"", 1);
+      if (tree->system_identifier.length) {
+        strbuf_put(out, " \"", 2);
+        put_text(out, tree, tree->system_identifier);
+        strbuf_put(out, "\"", 1);
+      }
+    } else if (tree->system_identifier.length) {
+      strbuf_put(out, " SYSTEM \"", 9);
+      put_text(out, tree, tree->system_identifier);
+      strbuf_put(out, "\"", 1);
     }
     strbuf_put(out, ">", 1);
   } else if (add_doctype) {
@@ -407,58 +253,99 @@ serialize_document(GumboStringBuffer *out, CleanseSerializer *serial,
                );
   }
 
-  for (i = 0; i < children->length; ++i) {
-    GumboNode *child = children->data[i];
-    serialize_node(out, serial, child);
+  serialize_children(out, serial, tree, tree->document);
+}
+
+/*
+ * Appends the HTML for `output` to `out`. Safe to call without the GVL;
+ * returns an error message, or NULL on success.
+ */
+const char *
+cleanse_serialize_output(GumboStringBuffer *out, GumboOutput *output,
+                         bool fragment, bool allow_doctype)
+{
+  CleanseSerialization serial;
+  serial.error = NULL;
+
+  if (fragment) {
+    serialize_children(out, &serial, output->compact, output->compact->root);
+  } else {
+    serialize_document(out, &serial, output->compact, allow_doctype);
   }
+
+  return serial.error;
 }
 
-static void
-rb_cleanse_serializer_free(CleanseSerializer *serial)
+typedef struct {
+  GumboOutput *output;
+  bool fragment;
+  bool allow_doctype;
+  GumboStringBuffer out;
+  const char *error;
+} SerializeArgs;
+
+static void *
+serialize_nogvl(void *_args)
 {
-  strbuf_free(&serial->out);
-  strbuf_free(&serial->current_text);
+  SerializeArgs *args = _args;
+
+  args->error = cleanse_serialize_output(
+                  &args->out, args->output, args->fragment, args->allow_doctype);
+
+  return NULL;
 }
 
 static void
-rb_cleanse_serializer_mark(CleanseSerializer *serial)
+rb_cleanse_serializer_mark(void *_serial)
 {
+  CleanseSerializer *serial = _serial;
   rb_gc_mark(serial->rb_document);
-  rb_gc_mark(serial->rb_current_text);
 }
 
+static const rb_data_type_t cleanse_serializer_type = {
+  "Cleanse::Serializer",
+  { rb_cleanse_serializer_mark, RUBY_TYPED_DEFAULT_FREE, NULL, },
+  0, 0,
+  RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
 static VALUE
 rb_cleanse_serializer_to_html(VALUE rb_self)
 {
   VALUE rb_result, rb_document, rb_sanitizer;
-  bool allow_doctype;
   CleanseSerializer *serial = NULL;
   CleanseSanitizer *sanitizer = NULL;
-  GumboOutput *output = NULL;
+  CleanseDocument *doc = NULL;
+  SerializeArgs args;
 
-  Data_Get_Struct(rb_self, CleanseSerializer, serial);
+  TypedData_Get_Struct(rb_self, CleanseSerializer, &cleanse_serializer_type, serial);
 
   rb_document = serial->rb_document;
-  Data_Get_Struct(rb_document, GumboOutput, output);
+  TypedData_Get_Struct(rb_document, CleanseDocument, &cleanse_document_type, doc);
 
-  if (rb_obj_is_kind_of(rb_document, rb_cDocumentFragment)) {
-    GumboVector *children = &output->root->v.element.children;
-    unsigned int x;
-    for (x = 0; x < children->length; ++x) {
-      serialize_node(&serial->out, serial, children->data[x]);
-    }
-  } else {
+  args.output = doc->output;
+  args.fragment = RTEST(rb_obj_is_kind_of(rb_document, rb_cDocumentFragment));
+  args.allow_doctype = false;
+
+  if (!args.fragment) {
     rb_sanitizer = rb_ivar_get(rb_document, g_id_sanitizer);
     if (!rb_obj_is_kind_of(rb_sanitizer, rb_cSanitizer)) {
       rb_raise(rb_eTypeError, "expected a Cleanse::Sanitizer instance");
     }
-    Data_Get_Struct(rb_sanitizer, CleanseSanitizer, sanitizer);
-    allow_doctype = sanitizer->allow_doctype;
+    TypedData_Get_Struct(rb_sanitizer, CleanseSanitizer, &cleanse_sanitizer_type, sanitizer);
+    args.allow_doctype = sanitizer->allow_doctype;
+  }
+
+  strbuf_init(&args.out);
+  cleanse_without_gvl(serialize_nogvl, &args, doc->source_len);
+  RB_GC_GUARD(rb_document);
 
-    serialize_document(&serial->out, serial, &output->document->v.document, allow_doctype);
+  if (args.error) {
+    strbuf_free(&args.out);
+    rb_raise(rb_eRuntimeError, "%s", args.error);
   }
 
-  rb_result = strbuf_to_rb(&serial->out, false);
+  rb_result = strbuf_to_rb(&args.out, true);
 
   return rb_result;
 }
@@ -468,14 +355,10 @@ static VALUE rb_cleanse_serializer_new(VALUE rb_klass, VALUE rb_document)
   VALUE rb_serializer;
   CleanseSerializer *serial = NULL;
 
-  rb_serializer = Data_Make_Struct(rb_klass, CleanseSerializer,
-                                   rb_cleanse_serializer_mark, rb_cleanse_serializer_free, serial);
-
-  strbuf_init(&serial->out);
-  strbuf_init(&serial->current_text);
+  rb_serializer = TypedData_Make_Struct(rb_klass, CleanseSerializer,
+                                        &cleanse_serializer_type, serial);
 
   serial->rb_document = rb_document;
-  serial->rb_current_text = cleanse_node_alloc(rb_cTextNode, rb_document, NULL);
 
   return rb_serializer;
 }
@@ -483,6 +366,7 @@ static VALUE rb_cleanse_serializer_new(VALUE rb_klass, VALUE rb_document)
 void Init_cleanse_serializer(void)
 {
   rb_cSerializer = rb_define_class_under(rb_mCleanse, "Serializer", rb_cObject);
+  rb_undef_alloc_func(rb_cSerializer);
   rb_define_singleton_method(rb_cSerializer, "new", rb_cleanse_serializer_new, 1);
   rb_define_method(rb_cSerializer, "to_html", rb_cleanse_serializer_to_html, 0);
 }
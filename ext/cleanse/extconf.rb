@@ -18,6 +18,12 @@ find_header("gumbo.h", GUMBO_SRC_DIR)
 find_header("parser.h", GUMBO_SRC_DIR)
 find_header("string_buffer.h", GUMBO_SRC_DIR)
 
+# Ruby 3.0+ lets us declare the extension Ractor-safe.
+have_func("rb_ext_ractor_safe", "ruby.h")
+
+# Sanitizer#sanitize_all runs on a pthread pool when available.
+have_header("pthread.h")
+
 # Symlink gumbo-parser source files.
 Dir.chdir(EXT_DIR) do
   $srcs = Dir["*.c", "nokogumbo/gumbo-parser/src/*.c"]
@@ -0,0 +1,75 @@
+// Times parsing each of the files named on the command line, with the options
+// Cleanse parses with. `make benchmark` builds this once with the tokenizer's
+// computed-goto dispatch and once with its function table, and runs both.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "gumbo.h"
+
+// Parse each file in this many rounds of about ROUND_SECONDS each, and report
+// the fastest round, which is the least disturbed by anything else running.
+#define ROUNDS 10
+#define ROUND_SECONDS 0.05
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char* read_file(const char* path, size_t* length) {
+  FILE* file = fopen(path, "rb");
+  if (!file)
+    return NULL;
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char* data = malloc(size > 0 ? size : 1);
+  *length = fread(data, 1, size, file);
+  fclose(file);
+  return data;
+}
+
+int main(int argc, char** argv) {
+  GumboOptions options = kGumboDefaultOptions;
+  options.max_errors = 0;
+  options.strip_disallowed_bytes = true;
+  options.structural_index = true;
+  options.use_arena = true;
+  options.skip_source_positions = true;
+
+  for (int i = 1; i < argc; ++i) {
+    size_t length;
+    char* html = read_file(argv[i], &length);
+    if (!html) {
+      perror(argv[i]);
+      return 1;
+    }
+
+    double best = 0;
+    for (int round = 0; round < ROUNDS; ++round) {
+      unsigned long runs = 0;
+      double start = now(), elapsed;
+      do {
+        GumboOutput* output = gumbo_parse_with_options(&options, html, length);
+        gumbo_destroy_output(output);
+        ++runs;
+      } while ((elapsed = now() - start) < ROUND_SECONDS);
+      if (round == 0 || elapsed / runs < best)
+        best = elapsed / runs;
+    }
+
+    printf (
+      "  %-40s %8zu bytes %10.1f us/parse %8.1f MB/s\n",
+      argv[i],
+      length,
+      best * 1e6,
+      length / best / 1e6
+    );
+    free(html);
+  }
+  return 0;
+}
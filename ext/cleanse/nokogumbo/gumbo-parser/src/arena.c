@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#if defined(_MSC_VER)
+# define GUMBO_THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L \
+      && !defined(__STDC_NO_THREADS__)
+# define GUMBO_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__) || defined(__clang__)
+# define GUMBO_THREAD_LOCAL __thread
+#endif
+
+// Every allocation is preceded by its (rounded up) size, so that it can be
+// reallocated. The union also fixes the alignment of what follows.
+typedef union {
+  size_t size;
+  void* align_pointer;
+  double align_double;
+  long long align_long_long;
+} Header;
+
+typedef struct Chunk {
+  struct Chunk* prev;
+  size_t size;
+  Header data[];
+} Chunk;
+
+struct GumboInternalArena {
+  // The chunk being allocated from, linked to the ones before it.
+  Chunk* chunk;
+  char* cursor;
+  char* end;
+  // The most recent allocation, if it hasn't been freed.
+  void* last;
+  size_t next_chunk_size;
+};
+
+#define MIN_CHUNK_SIZE ((size_t) 4096)
+#define MAX_FIRST_CHUNK_SIZE ((size_t) 64 << 20)
+
+static inline size_t round_up(size_t size) {
+  return (size + sizeof(Header) - 1) & ~(sizeof(Header) - 1);
+}
+
+static void* xmalloc(size_t size) {
+  void* ptr = malloc(size);
+  if (unlikely(ptr == NULL)) {
+    perror(__func__);
+    abort();
+  }
+  return ptr;
+}
+
+static void add_chunk(GumboArena* arena, size_t needed) {
+  size_t size = arena->next_chunk_size;
+  if (size < needed + sizeof(Chunk))
+    size = needed + sizeof(Chunk);
+  Chunk* chunk = xmalloc(size);
+  chunk->prev = arena->chunk;
+  chunk->size = size;
+  arena->chunk = chunk;
+  arena->cursor = (char*) chunk->data;
+  arena->end = (char*) chunk + size;
+  arena->last = NULL;
+  arena->next_chunk_size = size * 2;
+}
+
+#ifdef GUMBO_THREAD_LOCAL
+
+static GUMBO_THREAD_LOCAL GumboArena* current_arena;
+
+GumboArena* gumbo_arena_new(size_t input_length) {
+  GumboArena* arena = xmalloc(sizeof(GumboArena));
+  // Parse trees take up a few times the size of their source.
+  size_t size = input_length < MAX_FIRST_CHUNK_SIZE / 4
+    ? 4 * input_length + MIN_CHUNK_SIZE
+    : MAX_FIRST_CHUNK_SIZE;
+  arena->chunk = NULL;
+  arena->next_chunk_size = size;
+  add_chunk(arena, 0);
+  return arena;
+}
+
+GumboArena* gumbo_arena_enter(GumboArena* arena) {
+  GumboArena* previous = current_arena;
+  current_arena = arena;
+  return previous;
+}
+
+void gumbo_arena_leave(GumboArena* previous) {
+  current_arena = previous;
+}
+
+GumboArena* gumbo_arena_current(void) {
+  return current_arena;
+}
+
+#else // GUMBO_THREAD_LOCAL
+
+GumboArena* gumbo_arena_new(size_t UNUSED_ARG(input_length)) {
+  return NULL;
+}
+
+GumboArena* gumbo_arena_enter(GumboArena* UNUSED_ARG(arena)) {
+  return NULL;
+}
+
+void gumbo_arena_leave(GumboArena* UNUSED_ARG(previous)) {}
+
+GumboArena* gumbo_arena_current(void) {
+  return NULL;
+}
+
+#endif // GUMBO_THREAD_LOCAL
+
+void gumbo_arena_destroy(GumboArena* arena) {
+  Chunk* chunk = arena->chunk;
+  while (chunk) {
+    Chunk* prev = chunk->prev;
+    free(chunk);
+    chunk = prev;
+  }
+  free(arena);
+}
+
+bool gumbo_arena_owns(const GumboArena* arena, const void* ptr) {
+  // Chunks double in size, so there are only ever a handful of them.
+  for (const Chunk* chunk = arena->chunk; chunk; chunk = chunk->prev) {
+    const char* start = (const char*) chunk->data;
+    const char* end = (const char*) chunk + chunk->size;
+    if ((const char*) ptr >= start && (const char*) ptr < end)
+      return true;
+  }
+  return false;
+}
+
+void* gumbo_arena_alloc(GumboArena* arena, size_t size) {
+  size = round_up(size);
+  size_t needed = sizeof(Header) + size;
+  if ((size_t) (arena->end - arena->cursor) < needed)
+    add_chunk(arena, needed);
+  Header* header = (Header*) arena->cursor;
+  header->size = size;
+  arena->cursor += needed;
+  arena->last = header + 1;
+  return arena->last;
+}
+
+void* gumbo_arena_realloc(GumboArena* arena, void* ptr, size_t size) {
+  if (!ptr)
+    return gumbo_arena_alloc(arena, size);
+
+  Header* header = (Header*) ptr - 1;
+  size_t old_size = header->size;
+  size = round_up(size);
+  if (size <= old_size) {
+    // Shrinking the most recent allocation gives the rest back.
+    if (ptr == arena->last) {
+      header->size = size;
+      arena->cursor = (char*) ptr + size;
+    }
+    return ptr;
+  }
+
+  // The most recent allocation can grow in place.
+  if (ptr == arena->last && (size_t) (arena->end - (char*) ptr) >= size) {
+    header->size = size;
+    arena->cursor = (char*) ptr + size;
+    return ptr;
+  }
+
+  void* resized = gumbo_arena_alloc(arena, size);
+  memcpy(resized, ptr, old_size);
+  return resized;
+}
+
+void gumbo_arena_free(GumboArena* arena, void* ptr) {
+  // Only the most recent allocation can be given back; everything else is
+  // released with the arena.
+  if (ptr && ptr == arena->last) {
+    arena->cursor = (char*) ((Header*) ptr - 1);
+    arena->last = NULL;
+  }
+}
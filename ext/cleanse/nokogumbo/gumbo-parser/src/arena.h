@@ -0,0 +1,50 @@
+#ifndef GUMBO_ARENA_H_
+#define GUMBO_ARENA_H_
+
+// A bump allocator that owns every allocation made for one parse tree (see
+// GumboOptions.use_arena). While an arena is entered on a thread,
+// gumbo_alloc(), gumbo_realloc() and gumbo_free() on that thread go through
+// it: allocations are carved out of a chain of large chunks, frees are
+// no-ops (except for the most recent allocation, which is given back), and
+// the whole tree is released at once by gumbo_arena_destroy().
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "macros.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct GumboInternalArena;
+typedef struct GumboInternalArena GumboArena;
+
+// Creates an arena whose first chunk is sized for parsing `input_length`
+// bytes of HTML. Returns NULL if this platform has no thread-local storage,
+// in which case the caller should fall back to the system allocator.
+GumboArena* gumbo_arena_new(size_t input_length);
+
+// Releases every chunk, and so every allocation, of the arena.
+void gumbo_arena_destroy(GumboArena* arena);
+
+// Makes `arena` (which may be NULL, for the system allocator) the allocator
+// used by gumbo_alloc() and friends on the calling thread, and returns the
+// one that was in use, to be passed to gumbo_arena_leave().
+GumboArena* gumbo_arena_enter(GumboArena* arena);
+void gumbo_arena_leave(GumboArena* previous);
+
+// The arena entered on the calling thread, if any.
+GumboArena* gumbo_arena_current(void);
+
+// Returns true if `ptr` was allocated from `arena`.
+bool gumbo_arena_owns(const GumboArena* arena, const void* ptr) PURE;
+
+void* gumbo_arena_alloc(GumboArena* arena, size_t size) XMALLOC;
+void* gumbo_arena_realloc(GumboArena* arena, void* ptr, size_t size) RETURNS_NONNULL;
+void gumbo_arena_free(GumboArena* arena, void* ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GUMBO_ARENA_H_
@@ -13171,6 +13171,61 @@ static const int start = 7623;
 #line 2133 "src/char_ref.rl"
 
 
+// Nearly all references in real content are one of these few. Matching them
+// directly keeps the state machine's tables (and code) out of the cache for
+// the common case. Only the forms ending in a semicolon are handled here;
+// since every name that includes one ends there, these are always the
+// longest match.
+static size_t match_common_char_ref (
+  const char *str,
+  size_t size,
+  int output[2]
+) {
+  if (size < 3)
+    return 0;
+  switch (str[0]) {
+  case 'l':
+    if (str[1] == 't' && str[2] == ';') {
+      output[0] = '<';
+      return 3;
+    }
+    return 0;
+  case 'g':
+    if (str[1] == 't' && str[2] == ';') {
+      output[0] = '>';
+      return 3;
+    }
+    return 0;
+  case 'a':
+    if (size >= 4 && str[1] == 'm' && str[2] == 'p' && str[3] == ';') {
+      output[0] = '&';
+      return 4;
+    }
+    if (size >= 5 && str[1] == 'p' && str[2] == 'o' && str[3] == 's'
+        && str[4] == ';') {
+      output[0] = '\'';
+      return 5;
+    }
+    return 0;
+  case 'q':
+    if (size >= 5 && str[1] == 'u' && str[2] == 'o' && str[3] == 't'
+        && str[4] == ';') {
+      output[0] = '"';
+      return 5;
+    }
+    return 0;
+  case 'n':
+    if (size >= 5 && str[1] == 'b' && str[2] == 's' && str[3] == 'p'
+        && str[4] == ';') {
+      output[0] = 0xa0;
+      return 5;
+    }
+    return 0;
+  default:
+    return 0;
+  }
+}
+
 size_t match_named_char_ref (
   const char *str,
   size_t size,
@@ -13184,8 +13239,11 @@ size_t match_named_char_ref (
   const char *ts;
   const char *te;
   output[0] = output[1] = kGumboNoChar;
+  size_t common = match_common_char_ref(str, size, output);
+  if (common)
+    return common;
   
-#line 13189 "src/char_ref.c"
+#line 13247 "src/char_ref.c"
 	{
 	cs = start;
 	ts = 0;
@@ -13193,9 +13251,9 @@ size_t match_named_char_ref (
 	act = 0;
 	}
 
-#line 2149 "src/char_ref.rl"
+#line 2207 "src/char_ref.rl"
   
-#line 13199 "src/char_ref.c"
+#line 13257 "src/char_ref.c"
 	{
 	int _slen;
 	int _trans;
@@ -13211,7 +13269,7 @@ _resume:
 #line 1 "NONE"
 	{ts = p;}
 	break;
-#line 13215 "src/char_ref.c"
+#line 13273 "src/char_ref.c"
 	}
 
 	_keys = _trans_keys + (cs<<1);
@@ -22189,7 +22247,7 @@ _eof_trans:
 #line 1948 "src/char_ref.rl"
 	{{p = ((te))-1;}{output[0]=0xd7; {p++; goto _out; }}}
 	break;
-#line 22193 "src/char_ref.c"
+#line 22251 "src/char_ref.c"
 	}
 
 _again:
@@ -22198,7 +22256,7 @@ _again:
 #line 1 "NONE"
 	{ts = 0;}
 	break;
-#line 22202 "src/char_ref.c"
+#line 22260 "src/char_ref.c"
 	}
 
 	if ( cs == 0 )
@@ -22217,7 +22275,7 @@ _again:
 	_out: {}
 	}
 
-#line 2150 "src/char_ref.rl"
+#line 2208 "src/char_ref.rl"
   (void)ts;
   (void)act;
   size = p - str;
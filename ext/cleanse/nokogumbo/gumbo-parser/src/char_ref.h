@@ -10,6 +10,9 @@ extern "C" {
 // Value that indicates no character was produced.
 #define kGumboNoChar (-1)
 
+// Length of the longest named character reference, including the semicolon.
+#define kGumboMaxNamedCharRefLength 32
+
 // On input, str points to the start of the string to match and size is the
 // size of the string.
 //
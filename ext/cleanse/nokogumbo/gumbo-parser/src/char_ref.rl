@@ -2132,6 +2132,61 @@ named_char_ref := |*
 write data noerror nofinal noentry noprefix;
 }%%
 
+// Nearly all references in real content are one of these few. Matching them
+// directly keeps the state machine's tables (and code) out of the cache for
+// the common case. Only the forms ending in a semicolon are handled here;
+// since every name that includes one ends there, these are always the
+// longest match.
+static size_t match_common_char_ref (
+  const char *str,
+  size_t size,
+  int output[2]
+) {
+  if (size < 3)
+    return 0;
+  switch (str[0]) {
+  case 'l':
+    if (str[1] == 't' && str[2] == ';') {
+      output[0] = '<';
+      return 3;
+    }
+    return 0;
+  case 'g':
+    if (str[1] == 't' && str[2] == ';') {
+      output[0] = '>';
+      return 3;
+    }
+    return 0;
+  case 'a':
+    if (size >= 4 && str[1] == 'm' && str[2] == 'p' && str[3] == ';') {
+      output[0] = '&';
+      return 4;
+    }
+    if (size >= 5 && str[1] == 'p' && str[2] == 'o' && str[3] == 's'
+        && str[4] == ';') {
+      output[0] = '\'';
+      return 5;
+    }
+    return 0;
+  case 'q':
+    if (size >= 5 && str[1] == 'u' && str[2] == 'o' && str[3] == 't'
+        && str[4] == ';') {
+      output[0] = '"';
+      return 5;
+    }
+    return 0;
+  case 'n':
+    if (size >= 5 && str[1] == 'b' && str[2] == 's' && str[3] == 'p'
+        && str[4] == ';') {
+      output[0] = 0xa0;
+      return 5;
+    }
+    return 0;
+  default:
+    return 0;
+  }
+}
+
 size_t match_named_char_ref (
   const char *str,
   size_t size,
@@ -2145,6 +2200,9 @@ size_t match_named_char_ref (
   const char *ts;
   const char *te;
   output[0] = output[1] = kGumboNoChar;
+  size_t common = match_common_char_ref(str, size, output);
+  if (common)
+    return common;
   %% write init;
   %% write exec;
   (void)ts;
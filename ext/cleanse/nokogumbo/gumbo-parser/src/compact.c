@@ -0,0 +1,252 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compact.h"
+#include "macros.h"
+#include "util.h"
+
+static const GumboTextSpan kEmptySpan = {.offset = 0, .length = 0};
+
+GumboTextSpan gumbo_compact_add_text (
+  GumboCompactTree* tree,
+  const char* text,
+  size_t length
+) {
+  size_t needed = tree->text_length + length + 1;
+  // Span offsets have 31 bits for the heap, which is plenty for any input
+  // gumbo can parse.
+  if (unlikely(needed > GUMBO_COMPACT_INPUT_SPAN)) {
+    fputs("gumbo_compact_add_text: text heap exceeds 2 GiB\n", stderr);
+    abort();
+  }
+  if (needed > tree->text_capacity) {
+    size_t capacity = tree->text_capacity * 2;
+    if (capacity < needed)
+      capacity = needed;
+    tree->text = gumbo_realloc(tree->text, capacity);
+    tree->text_capacity = capacity;
+  }
+
+  GumboTextSpan span;
+  span.offset = (uint32_t) tree->text_length;
+  span.length = (uint32_t) length;
+  memcpy(tree->text + tree->text_length, text, length);
+  tree->text[tree->text_length + length] = '\0';
+  tree->text_length = needed;
+  return span;
+}
+
+GumboNodeIndex gumbo_compact_add_node(GumboCompactTree* tree, GumboNodeType type) {
+  if (tree->node_count == tree->node_capacity) {
+    tree->node_capacity *= 2;
+    tree->nodes = gumbo_realloc (
+      tree->nodes,
+      tree->node_capacity * sizeof(GumboCompactNode)
+    );
+  }
+
+  GumboNodeIndex index = tree->node_count++;
+  GumboCompactNode* node = &tree->nodes[index];
+  node->parent = GUMBO_COMPACT_NONE;
+  node->first_child = GUMBO_COMPACT_NONE;
+  node->last_child = GUMBO_COMPACT_NONE;
+  node->next_sibling = GUMBO_COMPACT_NONE;
+  node->type = type;
+  node->tag_namespace = GUMBO_NAMESPACE_HTML;
+  node->tag = GUMBO_TAG_UNKNOWN;
+  node->first_attribute = 0;
+  node->attribute_count = 0;
+  node->text = kEmptySpan;
+  return index;
+}
+
+static GumboTextSpan add_string(GumboCompactTree* tree, const char* str) {
+  return str ? gumbo_compact_add_text(tree, str, strlen(str)) : kEmptySpan;
+}
+
+// Refers to `slice` of the input if there is one, and otherwise copies the
+// `length` bytes of `str`.
+static GumboTextSpan add_borrowed_string (
+  GumboCompactTree* tree,
+  const char* str,
+  size_t length,
+  GumboStringPiece slice
+) {
+  if (slice.data && slice.length <= UINT32_MAX) {
+    size_t offset = slice.data - tree->input;
+    if (offset < GUMBO_COMPACT_INPUT_SPAN) {
+      GumboTextSpan span;
+      span.offset = (uint32_t) offset | GUMBO_COMPACT_INPUT_SPAN;
+      span.length = (uint32_t) slice.length;
+      return span;
+    }
+  }
+  return gumbo_compact_add_text(tree, str, length);
+}
+
+static void append_child (
+  GumboCompactTree* tree,
+  GumboNodeIndex parent,
+  GumboNodeIndex child
+) {
+  GumboCompactNode* parent_node = &tree->nodes[parent];
+  tree->nodes[child].parent = parent;
+  if (parent_node->last_child == GUMBO_COMPACT_NONE)
+    parent_node->first_child = child;
+  else
+    tree->nodes[parent_node->last_child].next_sibling = child;
+  parent_node->last_child = child;
+}
+
+static void add_attributes (
+  GumboCompactTree* tree,
+  GumboNodeIndex index,
+  const GumboVector* attributes
+) {
+  unsigned int needed = tree->attribute_count + attributes->length;
+  if (needed > tree->attribute_capacity) {
+    unsigned int capacity = tree->attribute_capacity * 2;
+    if (capacity < needed)
+      capacity = needed;
+    tree->attributes = gumbo_realloc (
+      tree->attributes,
+      capacity * sizeof(GumboCompactAttribute)
+    );
+    tree->attribute_capacity = capacity;
+  }
+
+  tree->nodes[index].first_attribute = tree->attribute_count;
+  tree->nodes[index].attribute_count = attributes->length;
+  for (unsigned int i = 0; i < attributes->length; ++i) {
+    const GumboAttribute* attr = attributes->data[i];
+    GumboCompactAttribute* compact = &tree->attributes[tree->attribute_count++];
+    compact->name = gumbo_compact_add_text(tree, attr->name, attr->name_length);
+    compact->value = add_borrowed_string (
+      tree,
+      attr->value,
+      attr->value_length,
+      attr->borrowed_value
+    );
+  }
+}
+
+static GumboNodeIndex copy_node(GumboCompactTree* tree, const GumboNode* node) {
+  GumboNodeIndex index = gumbo_compact_add_node(tree, node->type);
+
+  switch (node->type) {
+    case GUMBO_NODE_DOCUMENT: {
+      const GumboDocument* doc = &node->v.document;
+      tree->has_doctype = doc->has_doctype;
+      tree->doctype_name = add_string(tree, doc->name);
+      tree->public_identifier = add_string(tree, doc->public_identifier);
+      tree->system_identifier = add_string(tree, doc->system_identifier);
+      break;
+    }
+    case GUMBO_NODE_ELEMENT:
+    case GUMBO_NODE_TEMPLATE: {
+      const GumboElement* element = &node->v.element;
+      tree->nodes[index].tag = element->tag;
+      tree->nodes[index].tag_namespace = element->tag_namespace;
+      if (element->tag == GUMBO_TAG_UNKNOWN) {
+        GumboTextSpan name = add_string(tree, element->name);
+        tree->nodes[index].text = name;
+      }
+      add_attributes(tree, index, &element->attributes);
+      break;
+    }
+    case GUMBO_NODE_TEXT:
+    case GUMBO_NODE_CDATA:
+    case GUMBO_NODE_COMMENT:
+    case GUMBO_NODE_WHITESPACE: {
+      const GumboText* text_node = &node->v.text;
+      GumboTextSpan text = add_borrowed_string (
+        tree,
+        text_node->text,
+        text_node->length,
+        text_node->borrowed_text
+      );
+      tree->nodes[index].text = text;
+      break;
+    }
+  }
+  return index;
+}
+
+static const GumboVector* get_children(const GumboNode* node) {
+  switch (node->type) {
+    case GUMBO_NODE_DOCUMENT:
+      return &node->v.document.children;
+    case GUMBO_NODE_ELEMENT:
+    case GUMBO_NODE_TEMPLATE:
+      return &node->v.element.children;
+    default:
+      return NULL;
+  }
+}
+
+GumboCompactTree* gumbo_compact_tree_new (
+  const GumboNode* document,
+  const GumboNode* root,
+  const char* input
+) {
+  GumboCompactTree* tree = gumbo_alloc(sizeof(GumboCompactTree));
+  tree->input = input;
+  tree->node_count = 0;
+  tree->node_capacity = 64;
+  tree->nodes = gumbo_alloc(tree->node_capacity * sizeof(GumboCompactNode));
+  tree->attribute_count = 0;
+  tree->attribute_capacity = 0;
+  tree->attributes = NULL;
+  tree->text_length = 0;
+  tree->text_capacity = 1024;
+  tree->text = gumbo_alloc(tree->text_capacity);
+  // Offset 0 is the empty string that kEmptySpan refers to.
+  gumbo_compact_add_text(tree, "", 0);
+  tree->root = GUMBO_COMPACT_NONE;
+  tree->has_doctype = false;
+
+  // Walk the tree in document order, using the nodes' parent pointers and
+  // indices to move back up, and appending each node to the compact copy
+  // of its parent as it is reached.
+  const GumboNode* node = document;
+  GumboNodeIndex parent = GUMBO_COMPACT_NONE;
+  for (;;) {
+    GumboNodeIndex index = copy_node(tree, node);
+    if (parent != GUMBO_COMPACT_NONE)
+      append_child(tree, parent, index);
+    if (node == root)
+      tree->root = index;
+
+    const GumboVector* children = get_children(node);
+    if (children && children->length > 0) {
+      parent = index;
+      node = children->data[0];
+      continue;
+    }
+
+    for (;;) {
+      if (node == document) {
+        tree->document = 0;
+        return tree;
+      }
+      const GumboVector* siblings = get_children(node->parent);
+      unsigned int next = node->index_within_parent + 1;
+      assert(siblings->data[node->index_within_parent] == node);
+      if (next < siblings->length) {
+        node = siblings->data[next];
+        break;
+      }
+      node = node->parent;
+      parent = tree->nodes[parent].parent;
+    }
+  }
+}
+
+void gumbo_compact_tree_destroy(GumboCompactTree* tree) {
+  gumbo_free(tree->nodes);
+  gumbo_free(tree->attributes);
+  gumbo_free(tree->text);
+  gumbo_free(tree);
+}
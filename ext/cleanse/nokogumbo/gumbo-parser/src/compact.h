@@ -0,0 +1,29 @@
+#ifndef GUMBO_COMPACT_H_
+#define GUMBO_COMPACT_H_
+
+// Conversion of a GumboNode tree into the index-linked GumboCompactTree
+// layout (see GumboOptions.compact_tree).
+
+#include "gumbo.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Builds the compact form of the tree under `document`, whose `<html>`
+// element is `root` (which may be NULL), parsed from `input`. Borrowed text
+// and attribute values become spans of `input`, and everything else is
+// copied, so the GumboNodes are left untouched.
+GumboCompactTree* gumbo_compact_tree_new (
+  const GumboNode* document,
+  const GumboNode* root,
+  const char* input
+);
+
+void gumbo_compact_tree_destroy(GumboCompactTree* tree);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GUMBO_COMPACT_H_
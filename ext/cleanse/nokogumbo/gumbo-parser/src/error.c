@@ -338,6 +338,7 @@ static void handle_parser_error (
     case GUMBO_TOKEN_CDATA:
     case GUMBO_TOKEN_WHITESPACE:
     case GUMBO_TOKEN_CHARACTER:
+    case GUMBO_TOKEN_CHARACTER_RUN:
       print_message(output, "Character tokens aren't legal here");
       return;
     case GUMBO_TOKEN_NULL:
@@ -396,13 +397,7 @@ static const char* find_next_newline(
   return c;
 }
 
-GumboError* gumbo_add_error(GumboParser* parser) {
-  parser->_output->document_error = true;
-
-  int max_errors = parser->_options->max_errors;
-  if (max_errors >= 0 && parser->_output->errors.length >= (unsigned int) max_errors) {
-    return NULL;
-  }
+GumboError* gumbo_new_error(GumboParser* parser) {
   GumboError* error = gumbo_alloc(sizeof(GumboError));
   gumbo_vector_add(error, &parser->_output->errors);
   return error;
@@ -614,6 +609,18 @@ void gumbo_error_destroy(GumboError* error) {
   gumbo_free(error);
 }
 
+GumboError* gumbo_error_copy(const GumboError* error) {
+  GumboError* copy = gumbo_alloc(sizeof(GumboError));
+  *copy = *error;
+  if (error->type == GUMBO_ERR_PARSER) {
+    const GumboVector* tag_stack = &error->v.parser.tag_stack;
+    gumbo_vector_init(tag_stack->length, &copy->v.parser.tag_stack);
+    for (unsigned int i = 0; i < tag_stack->length; ++i)
+      gumbo_vector_add(tag_stack->data[i], &copy->v.parser.tag_stack);
+  }
+  return copy;
+}
+
 void gumbo_init_errors(GumboParser* parser) {
   gumbo_vector_init(5, &parser->_output->errors);
 }
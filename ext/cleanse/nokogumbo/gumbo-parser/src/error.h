@@ -5,6 +5,7 @@
 
 #include "gumbo.h"
 #include "insertion_mode.h"
+#include "parser.h"
 #include "string_buffer.h"
 #include "token_type.h"
 #include "tokenizer_states.h"
@@ -127,10 +128,27 @@ struct GumboInternalError {
   } v;
 };
 
-// Adds a new error to the parser's error list, and returns a pointer to it so
-// that clients can fill out the rest of its fields. May return NULL if we're
-// already over the max_errors field specified in GumboOptions.
-GumboError* gumbo_add_error(struct GumboInternalParser* parser);
+// Appends a new, blank error to the parser's error list. Use
+// gumbo_add_error() instead.
+GumboError* gumbo_new_error(struct GumboInternalParser* parser);
+
+// Records that the document has an error, and returns a new entry in the
+// parser's error list so that clients can fill out the rest of its fields.
+// Returns NULL if errors aren't being collected (the max_errors field of
+// GumboOptions is 0) or we're already at that limit, in which case the error
+// site should give up straight away: this is inline so that a parse without
+// diagnostics does no more at each error than set document_error.
+static inline GumboError* gumbo_add_error(struct GumboInternalParser* parser) {
+  parser->_output->document_error = true;
+  int max_errors = parser->_options->max_errors;
+  if (max_errors >= 0 && parser->_output->errors.length >= (unsigned int) max_errors) {
+    return NULL;
+  }
+  return gumbo_new_error(parser);
+}
+
+// Returns a copy of `error`, made with the current allocator.
+GumboError* gumbo_error_copy(const GumboError* error);
 
 // Initializes the errors vector in the parser.
 void gumbo_init_errors(struct GumboInternalParser* errors);
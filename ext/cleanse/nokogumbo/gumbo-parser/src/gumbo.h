@@ -31,6 +31,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -319,6 +320,9 @@ extern "C"
  */
   const char *gumbo_normalized_tagname(GumboTag tag);
 
+  /** Returns the length of `gumbo_normalized_tagname(tag)`. */
+  size_t gumbo_normalized_tagname_length(GumboTag tag);
+
   /**
  * Extracts the tag name from the `original_text` field of an element
  * or token by stripping off `</>` characters and attributes and
@@ -387,6 +391,9 @@ extern "C"
    */
     const char *name;
 
+    /** The length of `name` in bytes, not counting the terminator. */
+    size_t name_length;
+
     /**
    * The original text of the attribute name, as a pointer into the
    * original source buffer.
@@ -402,6 +409,9 @@ extern "C"
    */
     const char *value;
 
+    /** The length of `value` in bytes, not counting the terminator. */
+    size_t value_length;
+
     /**
    * The original text of the value of the attribute. This points into
    * the original source buffer. It includes any quotes that surround
@@ -412,6 +422,14 @@ extern "C"
    */
     GumboStringPiece original_value;
 
+    /**
+   * The value as a slice of the original source buffer, when it is
+   * identical to one byte for byte (nothing in it was decoded or
+   * replaced); otherwise `borrowed_value.data` is NULL. Unlike `value`,
+   * this is not null-terminated.
+   */
+    GumboStringPiece borrowed_value;
+
     /** The starting position of the attribute name. */
     GumboSourcePosition name_start;
 
@@ -618,6 +636,9 @@ extern "C"
    */
     const char *text;
 
+    /** The length of `text` in bytes, not counting the terminator. */
+    size_t length;
+
     /**
    * The original text of this node, as a pointer into the original
    * buffer. For comment/cdata nodes, this includes the comment
@@ -625,6 +646,14 @@ extern "C"
    */
     GumboStringPiece original_text;
 
+    /**
+   * For text, whitespace and CDATA nodes, the text as a slice of the
+   * original source buffer, when it is identical to one byte for byte;
+   * otherwise `borrowed_text.data` is NULL. Unlike `text`, this is not
+   * null-terminated.
+   */
+    GumboStringPiece borrowed_text;
+
     /**
    * The starting position of this node. This corresponds to the
    * position of `original_text`, before entities are decoded.
@@ -713,6 +742,134 @@ extern "C"
     } v;
   };
 
+  /**
+ * Index of a node in a `GumboCompactTree`, or `GUMBO_COMPACT_NONE` for no
+ * node at all.
+ */
+  typedef uint32_t GumboNodeIndex;
+
+#define GUMBO_COMPACT_NONE ((GumboNodeIndex) UINT32_MAX)
+
+  /**
+ * A string of a `GumboCompactTree`, `length` bytes long. Most spans are
+ * NUL-terminated strings in the tree's text heap; those with
+ * `GUMBO_COMPACT_INPUT_SPAN` set in their `offset` are slices of the
+ * parsed input instead, and are not terminated. Spans stay valid as the
+ * heap grows; pointers into it (see `gumbo_compact_text`) do not.
+ */
+  typedef struct
+  {
+    uint32_t offset;
+    uint32_t length;
+  } GumboTextSpan;
+
+#define GUMBO_COMPACT_INPUT_SPAN ((uint32_t) 1 << 31)
+
+  /** An attribute of a `GumboCompactNode`. */
+  typedef struct
+  {
+    /** The normalized (lowercased) attribute name. */
+    GumboTextSpan name;
+
+    /** The attribute value, with character references decoded. */
+    GumboTextSpan value;
+  } GumboCompactAttribute;
+
+  /**
+ * A node of a `GumboCompactTree`. Nodes are linked to each other by index
+ * rather than by pointer, and carry no source positions or original text.
+ */
+  typedef struct
+  {
+    GumboNodeIndex parent;
+    GumboNodeIndex first_child;
+    GumboNodeIndex last_child;
+    GumboNodeIndex next_sibling;
+
+    /** The `GumboNodeType` of this node. */
+    uint8_t type;
+
+    /** The `GumboNamespaceEnum` of an element. */
+    uint8_t tag_namespace;
+
+    /** The `GumboTag` of an element. */
+    uint16_t tag;
+
+    /**
+   * The attributes of an element are `attribute_count` consecutive entries
+   * of `GumboCompactTree.attributes`, starting at `first_attribute`.
+   */
+    uint32_t first_attribute;
+    uint32_t attribute_count;
+
+    /**
+   * The contents of a text, whitespace, CDATA or comment node, or the name
+   * of an element whose tag is `GUMBO_TAG_UNKNOWN`.
+   */
+    GumboTextSpan text;
+  } GumboCompactNode;
+
+  /**
+ * The parse tree in the layout produced with `GumboOptions.compact_tree`:
+ * every node in one array, every attribute in another, and every string
+ * in a single text heap, except for those that could be left as slices of
+ * the input.
+ */
+  typedef struct GumboInternalCompactTree
+  {
+    GumboCompactNode *nodes;
+    unsigned int node_count;
+    unsigned int node_capacity;
+
+    GumboCompactAttribute *attributes;
+    unsigned int attribute_count;
+    unsigned int attribute_capacity;
+
+    char *text;
+    size_t text_length;
+    size_t text_capacity;
+
+    /** The parsed input, which input spans point into. */
+    const char *input;
+
+    /** The `GUMBO_NODE_DOCUMENT` node. This is always node 0. */
+    GumboNodeIndex document;
+
+    /** The `<html>` element. */
+    GumboNodeIndex root;
+
+    /** The doctype of the document; see `GumboDocument`. */
+    bool has_doctype;
+    GumboTextSpan doctype_name;
+    GumboTextSpan public_identifier;
+    GumboTextSpan system_identifier;
+  } GumboCompactTree;
+
+  /**
+ * Returns the string that `span` refers to, in `tree`'s text heap or its
+ * input. Only `span.length` bytes of it may be read.
+ */
+  static inline const char *gumbo_compact_text(
+      const GumboCompactTree *tree, GumboTextSpan span)
+  {
+    if (span.offset & GUMBO_COMPACT_INPUT_SPAN)
+      return tree->input + (span.offset & ~GUMBO_COMPACT_INPUT_SPAN);
+    return tree->text + span.offset;
+  }
+
+  /**
+ * Appends a copy of `length` bytes of `text` to `tree`'s text heap, and
+ * returns its span.
+ */
+  GumboTextSpan gumbo_compact_add_text(
+      GumboCompactTree *tree, const char *text, size_t length);
+
+  /**
+ * Adds a detached node of the given type, with no children, attributes or
+ * text, to `tree` and returns its index. This may move `tree->nodes`.
+ */
+  GumboNodeIndex gumbo_compact_add_node(GumboCompactTree *tree, GumboNodeType type);
+
   /**
  * Input struct containing configuration options for the parser.
  * These let you specify alternate memory managers, provide different
@@ -806,6 +963,63 @@ extern "C"
    * Default: `false`.
    */
     bool fragment_context_has_form_ancestor;
+
+    /**
+   * Skip every input byte other than printable ASCII, tab, line feed, form
+   * feed and carriage return while reading the input, as if they had been
+   * removed from the buffer beforehand. This makes the iterator do the
+   * preprocessing itself, so the caller doesn't need a separate pass (and
+   * copy) over the input. Skipped bytes are not reported as parse errors.
+   *
+   * Default: `false`.
+   */
+    bool strip_disallowed_bytes;
+
+    /**
+   * Index the input with SIMD before tokenizing it, so that text, quoted
+   * attribute values and comments can be consumed a span at a time rather
+   * than a character at a time. This costs one bit of memory per input byte
+   * for the duration of the parse and pays off for all but tiny inputs.
+   *
+   * Default: `false`.
+   */
+    bool structural_index;
+
+    /**
+   * Allocate the whole output (nodes, strings, vectors and errors) from a
+   * single bump allocator owned by the `GumboOutput`, so that it is built
+   * with a handful of large allocations and `gumbo_destroy_output` just
+   * releases them instead of walking the tree. Nodes are then only ever
+   * freed along with the output.
+   *
+   * Default: `false`.
+   */
+    bool use_arena;
+
+    /**
+   * Hand back the tree as a `GumboCompactTree` (`GumboOutput.compact`)
+   * rather than as `GumboNode`s, for callers that have no use for source
+   * positions or original text. The tree is converted in one pass once
+   * parsing finishes and the `GumboNode`s are released, so
+   * `GumboOutput.document` and `GumboOutput.root` are `NULL`. Text and
+   * attribute values that are unchanged slices of the input are left
+   * pointing into it, so the input must outlive the output.
+   *
+   * Default: `false`.
+   */
+    bool compact_tree;
+
+    /**
+   * Don't keep track of line and column numbers or of the original text of
+   * tokens, for callers that never look at them. Source positions, in
+   * nodes, attributes and errors alike, then only have a byte `offset` (and
+   * not even that for attributes), and every `original_text`,
+   * `original_tag`, `original_end_tag`, `original_name` and
+   * `original_value` is empty.
+   *
+   * Default: `false`.
+   */
+    bool skip_source_positions;
   } GumboOptions;
 
   /** Default options struct; use this with gumbo_parse_with_options. */
@@ -880,6 +1094,17 @@ extern "C"
    * stopped mid-document due to exceptional circumstances.
    */
     GumboOutputStatus status;
+
+    /**
+   * The allocator that owns this output if it was parsed with
+   * `GumboOptions.use_arena`, or `NULL`.
+   */
+    struct GumboInternalArena *arena;
+
+    /**
+   * The tree, if it was parsed with `GumboOptions.compact_tree`, or `NULL`.
+   */
+    GumboCompactTree *compact;
   } GumboOutput;
 
   /**
@@ -912,6 +1137,12 @@ extern "C"
   /** Convert a `GumboOutputStatus` code into a readable description. */
   const char *gumbo_status_to_string(GumboOutputStatus status);
 
+  /**
+   * Release the memory used for a node and its subtree, which must have been
+   * detached from the tree. Nodes of an output parsed with
+   * `GumboOptions.use_arena` may only be destroyed while that output's
+   * arena is entered (see arena.h).
+   */
   void gumbo_destroy_node(GumboNode *node);
 
   /** Release the memory used for the parse tree and parse errors. */
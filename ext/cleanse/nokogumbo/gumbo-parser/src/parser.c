@@ -21,8 +21,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "ascii.h"
 #include "attribute.h"
+#include "compact.h"
 #include "error.h"
 #include "gumbo.h"
 #include "insertion_mode.h"
@@ -52,6 +54,11 @@ const GumboOptions kGumboDefaultOptions = {
   .fragment_encoding = NULL,
   .quirks_mode = GUMBO_DOCTYPE_NO_QUIRKS,
   .fragment_context_has_form_ancestor = false,
+  .strip_disallowed_bytes = false,
+  .structural_index = false,
+  .use_arena = false,
+  .compact_tree = false,
+  .skip_source_positions = false,
 };
 
 #define STRING(s) {.data = s, .length = sizeof(s) - 1}
@@ -185,6 +192,11 @@ typedef struct _TextNodeBufferState {
   // The source position of the start of this text node.
   GumboSourcePosition _start_position;
 
+  // The run of input that the accumulated text is identical to, if any (see
+  // gumbo_string_slice_extend), and the end of the input.
+  GumboStringPiece _input_slice;
+  const char* _input_end;
+
   // The type of node that will be inserted (TEXT, CDATA, or WHITESPACE).
   GumboNodeType _type;
 } TextNodeBufferState;
@@ -335,11 +347,12 @@ static void output_init(GumboParser* parser) {
   output->document = new_document_node();
   output->document_error = false;
   output->status = GUMBO_STATUS_OK;
+  output->compact = NULL;
   parser->_output = output;
   gumbo_init_errors(parser);
 }
 
-static void parser_state_init(GumboParser* parser) {
+static void parser_state_init(GumboParser* parser, const char* input_end) {
   GumboParserState* parser_state = gumbo_alloc(sizeof(GumboParserState));
   parser_state->_insertion_mode = GUMBO_INSERTION_MODE_INITIAL;
   parser_state->_reprocess_current_token = false;
@@ -348,6 +361,8 @@ static void parser_state_init(GumboParser* parser) {
   parser_state->_foster_parent_insertions = false;
   parser_state->_text_node._type = GUMBO_NODE_WHITESPACE;
   gumbo_string_buffer_init(&parser_state->_text_node._buffer);
+  parser_state->_text_node._input_slice = kGumboEmptyString;
+  parser_state->_text_node._input_end = input_end;
   gumbo_character_token_buffer_init(&parser_state->_table_character_tokens);
   gumbo_vector_init(10, &parser_state->_open_elements);
   gumbo_vector_init(5, &parser_state->_active_formatting_elements);
@@ -939,20 +954,26 @@ static void maybe_flush_text_node_buffer(GumboParser* parser) {
     || buffer_state->_type == GUMBO_NODE_TEXT
     || buffer_state->_type == GUMBO_NODE_CDATA
   );
+  gumbo_debug (
+    "Flushing text node buffer of %.*s.\n",
+    (int) buffer_state->_buffer.length,
+    buffer_state->_buffer.data
+  );
+
   GumboNode* text_node = create_node(buffer_state->_type);
   GumboText* text_node_data = &text_node->v.text;
-  text_node_data->text = gumbo_string_buffer_to_string(&buffer_state->_buffer);
+  // The node takes over the buffer, which starts again with fresh storage.
+  text_node_data->length = buffer_state->_buffer.length;
+  text_node_data->text = gumbo_string_buffer_release(&buffer_state->_buffer);
   text_node_data->original_text.data = buffer_state->_start_original_text;
   text_node_data->original_text.length =
       state->_current_token->original_text.data -
       buffer_state->_start_original_text;
   text_node_data->start_pos = buffer_state->_start_position;
-
-  gumbo_debug (
-    "Flushing text node buffer of %.*s.\n",
-    (int) buffer_state->_buffer.length,
-    buffer_state->_buffer.data
-  );
+  text_node_data->borrowed_text = buffer_state->_input_slice;
+  if (!text_node_data->borrowed_text.data)
+    text_node_data->borrowed_text = kGumboEmptyString;
+  buffer_state->_input_slice = kGumboEmptyString;
 
   InsertionLocation location = get_appropriate_insertion_location(parser, NULL);
   if (location.target->type == GUMBO_NODE_DOCUMENT) {
@@ -963,7 +984,6 @@ static void maybe_flush_text_node_buffer(GumboParser* parser) {
     insert_node(text_node, location);
   }
 
-  gumbo_string_buffer_clear(&buffer_state->_buffer);
   buffer_state->_type = GUMBO_NODE_WHITESPACE;
   assert(buffer_state->_buffer.length == 0);
 }
@@ -1037,7 +1057,9 @@ static void append_comment_node (
   comment->type = GUMBO_NODE_COMMENT;
   comment->parse_flags = GUMBO_INSERTION_NORMAL;
   comment->v.text.text = token->v.text;
+  comment->v.text.length = strlen(token->v.text);
   comment->v.text.original_text = token->original_text;
+  comment->v.text.borrowed_text = kGumboEmptyString;
   comment->v.text.start_pos = token->position;
   append_node(node, comment);
 }
@@ -1115,9 +1137,13 @@ static GumboNode* create_element_from_token (
   element->name = start_tag->name ? start_tag->name : gumbo_normalized_tagname(start_tag->tag);
   element->tag_namespace = tag_namespace;
 
-  assert(token->original_text.length >= 2);
-  assert(token->original_text.data[0] == '<');
-  assert(token->original_text.data[token->original_text.length - 1] == '>');
+  // Without source positions, tokens have no original text to check.
+  assert(!token->original_text.data || token->original_text.length >= 2);
+  assert(!token->original_text.data || token->original_text.data[0] == '<');
+  assert (
+    !token->original_text.data
+    || token->original_text.data[token->original_text.length - 1] == '>'
+  );
   element->original_tag = token->original_text;
   element->start_pos = token->position;
   element->original_end_tag = kGumboEmptyString;
@@ -1229,6 +1255,7 @@ static void insert_text_token(GumboParser* parser, GumboToken* token) {
   assert (
     token->type == GUMBO_TOKEN_WHITESPACE
     || token->type == GUMBO_TOKEN_CHARACTER
+    || token->type == GUMBO_TOKEN_CHARACTER_RUN
     || token->type == GUMBO_TOKEN_NULL
     || token->type == GUMBO_TOKEN_CDATA
   );
@@ -1238,10 +1265,37 @@ static void insert_text_token(GumboParser* parser, GumboToken* token) {
     buffer_state->_start_original_text = token->original_text.data;
     buffer_state->_start_position = token->position;
   }
+  if (token->type == GUMBO_TOKEN_CHARACTER_RUN) {
+    const GumboTokenCharacterRun* run = &token->v.character_run;
+    GumboStringPiece text = { .data = run->data, .length = run->length };
+    gumbo_string_buffer_append_string(&text, &buffer_state->_buffer);
+    gumbo_string_slice_extend (
+      &buffer_state->_input_slice,
+      run->data,
+      buffer_state->_input_end,
+      run->data,
+      run->length
+    );
+    if (!run->is_whitespace) {
+      buffer_state->_type = GUMBO_NODE_TEXT;
+    }
+    gumbo_debug("Inserting text run '%.*s'.\n", (int) run->length, run->data);
+    return;
+  }
+  size_t length = buffer_state->_buffer.length;
   gumbo_string_buffer_append_codepoint (
     token->v.character,
     &buffer_state->_buffer
   );
+  // Without source positions a single character can't start a slice, but
+  // it can still extend one.
+  gumbo_string_slice_extend (
+    &buffer_state->_input_slice,
+    token->original_text.data,
+    buffer_state->_input_end,
+    buffer_state->_buffer.data + length,
+    buffer_state->_buffer.length - length
+  );
   if (token->type == GUMBO_TOKEN_CHARACTER) {
     buffer_state->_type = GUMBO_NODE_TEXT;
   } else if (token->type == GUMBO_TOKEN_CDATA) {
@@ -1957,7 +2011,7 @@ static void adjust_foreign_attributes(GumboToken* token) {
     GumboAttribute* attr = attributes->data[i];
     const ForeignAttrReplacement* entry = gumbo_get_foreign_attr_replacement (
       attr->name,
-      strlen(attr->name)
+      attr->name_length
     );
     if (!entry) {
       continue;
@@ -1965,6 +2019,7 @@ static void adjust_foreign_attributes(GumboToken* token) {
     gumbo_free((void*) attr->name);
     attr->attr_namespace = entry->attr_namespace;
     attr->name = gumbo_strdup(entry->local_name);
+    attr->name_length = strlen(attr->name);
   }
 }
 
@@ -1997,13 +2052,14 @@ static void adjust_svg_attributes(GumboToken* token) {
     GumboAttribute* attr = (GumboAttribute*) attributes->data[i];
     const StringReplacement* replacement = gumbo_get_svg_attr_replacement (
       attr->name,
-      attr->original_name.length
+      attr->name_length
     );
     if (!replacement) {
       continue;
     }
     gumbo_free((void*) attr->name);
     attr->name = gumbo_strdup(replacement->to);
+    attr->name_length = strlen(attr->name);
   }
 }
 
@@ -2021,6 +2077,7 @@ static void adjust_mathml_attributes(GumboToken* token) {
   }
   gumbo_free((void*) attr->name);
   attr->name = gumbo_strdup("definitionURL");
+  attr->name_length = 13;
 }
 
 static void maybe_add_doctype_error (
@@ -2807,6 +2864,13 @@ static void handle_in_body(GumboParser* parser, GumboToken* token) {
     set_frameset_not_ok(parser);
     return;
   }
+  if (token->type == GUMBO_TOKEN_CHARACTER_RUN) {
+    reconstruct_active_formatting_elements(parser);
+    insert_text_token(parser, token);
+    if (!token->v.character_run.is_whitespace)
+      set_frameset_not_ok(parser);
+    return;
+  }
   if (token->type == GUMBO_TOKEN_COMMENT) {
     append_comment_node(parser, get_current_node(parser), token);
     return;
@@ -3402,6 +3466,7 @@ static void handle_in_body(GumboParser* parser, GumboToken* token) {
 static void handle_text(GumboParser* parser, GumboToken* token) {
   if (
     token->type == GUMBO_TOKEN_CHARACTER
+    || token->type == GUMBO_TOKEN_CHARACTER_RUN
     || token->type == GUMBO_TOKEN_WHITESPACE
   ) {
     insert_text_token(parser, token);
@@ -4059,6 +4124,7 @@ static void handle_in_template(GumboParser* parser, GumboToken* token) {
   switch (token->type) {
     case GUMBO_TOKEN_WHITESPACE:
     case GUMBO_TOKEN_CHARACTER:
+    case GUMBO_TOKEN_CHARACTER_RUN:
     case GUMBO_TOKEN_COMMENT:
     case GUMBO_TOKEN_NULL:
     case GUMBO_TOKEN_DOCTYPE:
@@ -4509,6 +4575,23 @@ static void handle_token(GumboParser* parser, GumboToken* token) {
     ignore_token(parser);
     return;
   }
+  if (
+    parser->_parser_state->_ignore_next_linefeed
+    && token->type == GUMBO_TOKEN_CHARACTER_RUN
+    && token->v.character_run.data[0] == '\n'
+  ) {
+    // Runs are at least two characters long, so something is left over.
+    assert(token->v.character_run.length > 1);
+    ++token->v.character_run.data;
+    --token->v.character_run.length;
+    ++token->position.offset;
+    if (token->original_text.data) {
+      ++token->original_text.data;
+      --token->original_text.length;
+      ++token->position.line;
+      token->position.column = 1;
+    }
+  }
   // This needs to be reset both here and in the conditional above to catch both
   // the case where the next token is not whitespace (so we don't ignore
   // whitespace in the middle of <pre> tags) and where there are multiple
@@ -4573,9 +4656,12 @@ static GumboNode* create_fragment_ctx_element (
     GumboAttribute* attr = gumbo_alloc(sizeof(GumboAttribute));
     attr->attr_namespace = GUMBO_ATTR_NAMESPACE_NONE;
     attr->name = "encoding"; // Do not free this!
+    attr->name_length = 8;
     attr->original_name = kGumboEmptyString;
     attr->value = encoding; // Do not free this!
+    attr->value_length = strlen(encoding);
     attr->original_value = kGumboEmptyString;
+    attr->borrowed_value = kGumboEmptyString;
     attr->name_start = kGumboEmptySourcePosition;
     gumbo_vector_add(attr, &element->attributes);
   } else {
@@ -4703,6 +4789,22 @@ static void fragment_parser_init (
   }
 }
 
+// Returns true if the given (HTML content) insertion mode handles every
+// character and whitespace token by inserting it as text, so that it can take
+// a whole GUMBO_TOKEN_CHARACTER_RUN in one step.
+static bool accepts_character_runs(GumboInsertionMode mode) {
+  switch (mode) {
+    case GUMBO_INSERTION_MODE_IN_BODY:
+    case GUMBO_INSERTION_MODE_TEXT:
+    case GUMBO_INSERTION_MODE_IN_CAPTION:
+    case GUMBO_INSERTION_MODE_IN_CELL:
+    case GUMBO_INSERTION_MODE_IN_TEMPLATE:
+      return true;
+    default:
+      return false;
+  }
+}
+
 GumboOutput* gumbo_parse(const char* buffer) {
   return gumbo_parse_with_options (
     &kGumboDefaultOptions,
@@ -4711,6 +4813,26 @@ GumboOutput* gumbo_parse(const char* buffer) {
   );
 }
 
+// Replaces `output` with one that holds the compact form of its tree and
+// copies of its errors. This runs outside the arena, if there was one, so
+// that the arena and the GumboNodes in it can be released.
+static GumboOutput* compact_output(GumboOutput* output, const char* input) {
+  GumboOutput* compact = gumbo_alloc(sizeof(GumboOutput));
+  *compact = *output;
+  compact->document = NULL;
+  compact->root = NULL;
+  compact->arena = NULL;
+  compact->compact =
+    gumbo_compact_tree_new(output->document, output->root, input);
+  gumbo_vector_init(output->errors.length, &compact->errors);
+  for (unsigned int i = 0; i < output->errors.length; ++i) {
+    GumboError* error = gumbo_error_copy(output->errors.data[i]);
+    gumbo_vector_add(error, &compact->errors);
+  }
+  gumbo_destroy_output(output);
+  return compact;
+}
+
 GumboOutput* gumbo_parse_with_options (
   const GumboOptions* options,
   const char* buffer,
@@ -4718,9 +4840,16 @@ GumboOutput* gumbo_parse_with_options (
 ) {
   GumboParser parser;
   parser._options = options;
+
+  GumboArena* arena = options->use_arena ? gumbo_arena_new(length) : NULL;
+  GumboArena* previous_arena = NULL;
+  if (arena)
+    previous_arena = gumbo_arena_enter(arena);
+
   output_init(&parser);
+  parser._output->arena = arena;
   gumbo_tokenizer_state_init(&parser, buffer, length);
-  parser_state_init(&parser);
+  parser_state_init(&parser, buffer + length);
 
   if (options->fragment_context != NULL)
     fragment_parser_init(&parser, options);
@@ -4744,10 +4873,13 @@ GumboOutput* gumbo_parse_with_options (
       state->_reprocess_current_token = false;
     } else {
       GumboNode* adjusted_current_node = get_adjusted_current_node(&parser);
-      gumbo_tokenizer_set_is_adjusted_current_node_foreign (
-        &parser,
+      bool is_foreign =
         adjusted_current_node &&
-          adjusted_current_node->v.element.tag_namespace != GUMBO_NAMESPACE_HTML
+          adjusted_current_node->v.element.tag_namespace != GUMBO_NAMESPACE_HTML;
+      gumbo_tokenizer_set_is_adjusted_current_node_foreign(&parser, is_foreign);
+      gumbo_tokenizer_set_allow_character_runs (
+        &parser,
+        !is_foreign && accepts_character_runs(state->_insertion_mode)
       );
       gumbo_lex(&parser, &token);
     }
@@ -4846,6 +4978,10 @@ GumboOutput* gumbo_parse_with_options (
 
   parser_state_destroy(&parser);
   gumbo_tokenizer_state_destroy(&parser);
+  if (arena)
+    gumbo_arena_leave(previous_arena);
+  if (options->compact_tree)
+    return compact_output(parser._output, buffer);
   return parser._output;
 }
 
@@ -4869,7 +5005,15 @@ void gumbo_destroy_node(GumboNode* node) {
 }
 
 void gumbo_destroy_output(GumboOutput* output) {
-  destroy_node(output->document);
+  if (output->arena) {
+    // The output itself lives in the arena.
+    gumbo_arena_destroy(output->arena);
+    return;
+  }
+  if (output->compact)
+    gumbo_compact_tree_destroy(output->compact);
+  if (output->document)
+    destroy_node(output->document);
   for (unsigned int i = 0; i < output->errors.length; ++i) {
     gumbo_error_destroy(output->errors.data[i]);
   }
@@ -90,6 +90,47 @@ char* gumbo_string_buffer_to_string(const GumboStringBuffer* input) {
   return buffer;
 }
 
+char* gumbo_string_buffer_release(GumboStringBuffer* buffer) {
+  size_t size = buffer->length + 1;
+  char* data = buffer->data;
+  // Growing for the terminator doesn't double the buffer, and it's only
+  // shrunk when more than half of it would go to waste.
+  if (buffer->capacity < size || buffer->capacity / 2 > size) {
+    data = gumbo_realloc(data, size);
+  }
+  data[buffer->length] = '\0';
+  gumbo_string_buffer_init(buffer);
+  return data;
+}
+
+void gumbo_string_slice_extend (
+  GumboStringPiece* slice,
+  const char* start,
+  const char* end,
+  const char* data,
+  size_t length
+) {
+  if (length == 0)
+    return;
+  if (slice->length == 0) {
+    slice->length = length;
+    slice->data = NULL;
+    if (start && length <= (size_t) (end - start)
+        && (start == data || !memcmp(start, data, length)))
+      slice->data = start;
+    return;
+  }
+  // A slice that has already been given up on just keeps a non-zero length.
+  if (!slice->data)
+    return;
+  const char* next = slice->data + slice->length;
+  if (length <= (size_t) (end - next)
+      && (next == data || !memcmp(next, data, length)))
+    slice->length += length;
+  else
+    slice->data = NULL;
+}
+
 void gumbo_string_buffer_clear(GumboStringBuffer* input) {
   input->length = 0;
 }
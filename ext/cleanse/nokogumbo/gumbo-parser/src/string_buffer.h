@@ -57,6 +57,24 @@ extern "C"
   // Converts this string buffer to const char*, alloctaing a new buffer for it.
   char *gumbo_string_buffer_to_string(const GumboStringBuffer *input);
 
+  // Hands the buffer's storage over as a nul-terminated string, trimmed if
+  // it's mostly unused, and gives the buffer a fresh allocation. This saves
+  // the copy that gumbo_string_buffer_to_string() makes.
+  char *gumbo_string_buffer_release(GumboStringBuffer *buffer);
+
+  // Keeps `slice` in step with a buffer that just had the `length` bytes at
+  // `data` appended to it: as long as the buffer's contents are identical
+  // to a run of the input that ends at `end`, `slice` is that run, and
+  // once they aren't its data is NULL. `start` is where in the input the
+  // bytes may have come from, which only matters when the buffer was empty
+  // (and `slice` had 0 length) before; it may be NULL if that's unknown.
+  void gumbo_string_slice_extend(
+      GumboStringPiece *slice,
+      const char *start,
+      const char *end,
+      const char *data,
+      size_t length);
+
   // Reinitialize this string buffer. This clears it by setting length=0. It
   // does not zero out the buffer itself.
   void gumbo_string_buffer_clear(GumboStringBuffer *input);
@@ -0,0 +1,178 @@
+#include "structural.h"
+#include "arena.h"
+#include "util.h"
+
+#if (GNUC_AT_LEAST(4, 9) || defined(__clang__)) \
+    && defined(__x86_64__) && defined(__SSE2__)
+# define GUMBO_STRUCTURAL_X86 1
+# include <immintrin.h>
+#endif
+
+static inline bool is_stop_byte(unsigned char c) {
+  switch (c) {
+    case '<':
+    case '&':
+    case '"':
+    case '\'':
+    case '-':
+      return true;
+    case '\t':
+    case '\n':
+    case '\f':
+      return false;
+    default:
+      return c < 0x20 || c >= 0x7F;
+  }
+}
+
+static uint64_t stop_mask_scalar(const unsigned char* data, size_t length) {
+  uint64_t mask = 0;
+  for (size_t i = 0; i < length; ++i) {
+    if (is_stop_byte(data[i]))
+      mask |= (uint64_t) 1 << i;
+  }
+  return mask;
+}
+
+#ifdef GUMBO_STRUCTURAL_X86
+// Bytes that compare (signed) below ' ' are the C0 controls and every byte
+// with the high bit set; of those, only tab, LF and FF are not stops.
+static inline uint64_t stop_mask_sse2(const unsigned char* data) {
+  uint64_t mask = 0;
+  for (int i = 0; i < 4; ++i) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (data + 16 * i));
+    __m128i low = _mm_andnot_si128 (
+      _mm_or_si128 (
+        _mm_or_si128 (
+          _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')),
+          _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))
+        ),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('\f'))
+      ),
+      _mm_cmplt_epi8(v, _mm_set1_epi8(0x20))
+    );
+    __m128i markup = _mm_or_si128 (
+      _mm_or_si128 (
+        _mm_or_si128 (
+          _mm_cmpeq_epi8(v, _mm_set1_epi8('<')),
+          _mm_cmpeq_epi8(v, _mm_set1_epi8('&'))
+        ),
+        _mm_or_si128 (
+          _mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+          _mm_cmpeq_epi8(v, _mm_set1_epi8('\''))
+        )
+      ),
+      _mm_or_si128 (
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('-')),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7F))
+      )
+    );
+    uint64_t bits = (uint16_t) _mm_movemask_epi8(_mm_or_si128(low, markup));
+    mask |= bits << (16 * i);
+  }
+  return mask;
+}
+
+static void build_sse2(GumboStructuralIndex* index) {
+  const unsigned char* data = (const unsigned char*) index->_base;
+  size_t blocks = index->_length / 64;
+  for (size_t i = 0; i < blocks; ++i)
+    index->_bits[i] = stop_mask_sse2(data + 64 * i);
+  if (index->_length % 64) {
+    index->_bits[blocks] =
+      stop_mask_scalar(data + 64 * blocks, index->_length % 64);
+  }
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t stop_mask_avx2(const unsigned char* data) {
+  uint64_t mask = 0;
+  for (int i = 0; i < 2; ++i) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (data + 32 * i));
+    __m256i low = _mm256_andnot_si256 (
+      _mm256_or_si256 (
+        _mm256_or_si256 (
+          _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')),
+          _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))
+        ),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\f'))
+      ),
+      _mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), v)
+    );
+    __m256i markup = _mm256_or_si256 (
+      _mm256_or_si256 (
+        _mm256_or_si256 (
+          _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')),
+          _mm256_cmpeq_epi8(v, _mm256_set1_epi8('&'))
+        ),
+        _mm256_or_si256 (
+          _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+          _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\''))
+        )
+      ),
+      _mm256_or_si256 (
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-')),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7F))
+      )
+    );
+    uint64_t bits =
+      (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(low, markup));
+    mask |= bits << (32 * i);
+  }
+  return mask;
+}
+
+__attribute__((target("avx2")))
+static void build_avx2(GumboStructuralIndex* index) {
+  const unsigned char* data = (const unsigned char*) index->_base;
+  size_t blocks = index->_length / 64;
+  for (size_t i = 0; i < blocks; ++i)
+    index->_bits[i] = stop_mask_avx2(data + 64 * i);
+  if (index->_length % 64) {
+    index->_bits[blocks] =
+      stop_mask_scalar(data + 64 * blocks, index->_length % 64);
+  }
+}
+#endif // GUMBO_STRUCTURAL_X86
+
+#ifndef GUMBO_STRUCTURAL_X86
+static void build_scalar(GumboStructuralIndex* index) {
+  const unsigned char* data = (const unsigned char*) index->_base;
+  size_t words = (index->_length + 63) / 64;
+  for (size_t i = 0; i < words; ++i) {
+    size_t length = index->_length - 64 * i;
+    index->_bits[i] = stop_mask_scalar(data + 64 * i, length < 64 ? length : 64);
+  }
+}
+#endif
+
+void gumbo_structural_index_init (
+  GumboStructuralIndex* index,
+  const char* data,
+  size_t length
+) {
+  size_t words = (length + 63) / 64;
+  index->_base = data;
+  index->_length = length;
+  // The index is scratch space for the parse, so keep it out of the tree's
+  // arena, if there is one; gumbo_free() still does the right thing.
+  GumboArena* arena = gumbo_arena_enter(NULL);
+  index->_bits = gumbo_alloc((words ? words : 1) * sizeof(uint64_t));
+  gumbo_arena_leave(arena);
+  index->_bits[0] = 0;
+
+#ifdef GUMBO_STRUCTURAL_X86
+  if (__builtin_cpu_supports("avx2")) {
+    build_avx2(index);
+    return;
+  }
+  build_sse2(index);
+#else
+  build_scalar(index);
+#endif
+}
+
+void gumbo_structural_index_destroy(GumboStructuralIndex* index) {
+  gumbo_free(index->_bits);
+  index->_bits = NULL;
+}
@@ -0,0 +1,92 @@
+#ifndef GUMBO_STRUCTURAL_H_
+#define GUMBO_STRUCTURAL_H_
+
+// A bitmap over the input buffer with one bit set for every byte at which
+// one of the bulk-skipping tokenizer states (data, RCDATA, RAWTEXT, script
+// data, PLAINTEXT, quoted attribute values and comments) may have to stop.
+// It is built once, before tokenization starts, so that those states can
+// jump from one interesting byte to the next instead of examining every
+// character.
+//
+// The stop bytes are '<', '&', '"', '\'', '-', NUL, CR, and everything that
+// isn't printable ASCII, tab, LF or FF (control characters and non-ASCII
+// bytes still go through the per-character path for decoding, newline
+// normalization and error reporting). No skipping state ever stops at plain
+// whitespace, '>' or '=', so those are left out.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "macros.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  // Start of the indexed buffer.
+  const char* _base;
+
+  // Number of bytes indexed.
+  size_t _length;
+
+  // Bit (i % 64) of word (i / 64) is set if _base[i] is a stop byte. NULL if
+  // the index hasn't been built.
+  uint64_t* _bits;
+} GumboStructuralIndex;
+
+// Builds the index for the given buffer, using the widest SIMD the CPU
+// supports.
+void gumbo_structural_index_init (
+  GumboStructuralIndex* index,
+  const char* data,
+  size_t length
+);
+
+void gumbo_structural_index_destroy(GumboStructuralIndex* index);
+
+// Index of the lowest set bit of a nonzero word.
+static inline unsigned int gumbo_structural_ctz(uint64_t bits) {
+#if GNUC_AT_LEAST(3, 4) || defined(__clang__)
+  return (unsigned int) __builtin_ctzll(bits);
+#else
+  unsigned int n = 0;
+  while (!(bits & 1)) {
+    bits >>= 1;
+    ++n;
+  }
+  return n;
+#endif
+}
+
+// Returns true if the index has been built.
+static inline bool gumbo_structural_index_is_built(const GumboStructuralIndex* index) {
+  return index->_bits != NULL;
+}
+
+// Returns a pointer to the first stop byte at or after `from`, which must
+// point into the indexed buffer, or the end of the buffer if there is none.
+static inline const char* gumbo_structural_index_next (
+  const GumboStructuralIndex* index,
+  const char* from
+) {
+  size_t i = from - index->_base;
+  size_t word = i / 64;
+  size_t words = (index->_length + 63) / 64;
+  if (word >= words)
+    return index->_base + index->_length;
+  uint64_t bits = index->_bits[word] >> (i % 64);
+  if (bits)
+    return from + gumbo_structural_ctz(bits);
+  while (++word < words) {
+    if (index->_bits[word])
+      return index->_base + word * 64 + gumbo_structural_ctz(index->_bits[word]);
+  }
+  return index->_base + index->_length;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GUMBO_STRUCTURAL_H_
@@ -21,161 +21,173 @@
 #include <assert.h>
 #include <string.h>
 
+// The normalized name of every tag, expanded once for the names themselves
+// and once for their lengths.
+#define GUMBO_TAG_NAMES(X) \
+  X(GUMBO_TAG_HTML, "html")                     \
+  X(GUMBO_TAG_HEAD, "head")                     \
+  X(GUMBO_TAG_TITLE, "title")                   \
+  X(GUMBO_TAG_BASE, "base")                     \
+  X(GUMBO_TAG_LINK, "link")                     \
+  X(GUMBO_TAG_META, "meta")                     \
+  X(GUMBO_TAG_STYLE, "style")                   \
+  X(GUMBO_TAG_SCRIPT, "script")                 \
+  X(GUMBO_TAG_NOSCRIPT, "noscript")             \
+  X(GUMBO_TAG_TEMPLATE, "template")             \
+  X(GUMBO_TAG_BODY, "body")                     \
+  X(GUMBO_TAG_ARTICLE, "article")               \
+  X(GUMBO_TAG_SECTION, "section")               \
+  X(GUMBO_TAG_NAV, "nav")                       \
+  X(GUMBO_TAG_ASIDE, "aside")                   \
+  X(GUMBO_TAG_H1, "h1")                         \
+  X(GUMBO_TAG_H2, "h2")                         \
+  X(GUMBO_TAG_H3, "h3")                         \
+  X(GUMBO_TAG_H4, "h4")                         \
+  X(GUMBO_TAG_H5, "h5")                         \
+  X(GUMBO_TAG_H6, "h6")                         \
+  X(GUMBO_TAG_HGROUP, "hgroup")                 \
+  X(GUMBO_TAG_HEADER, "header")                 \
+  X(GUMBO_TAG_FOOTER, "footer")                 \
+  X(GUMBO_TAG_ADDRESS, "address")               \
+  X(GUMBO_TAG_P, "p")                           \
+  X(GUMBO_TAG_HR, "hr")                         \
+  X(GUMBO_TAG_PRE, "pre")                       \
+  X(GUMBO_TAG_BLOCKQUOTE, "blockquote")         \
+  X(GUMBO_TAG_OL, "ol")                         \
+  X(GUMBO_TAG_UL, "ul")                         \
+  X(GUMBO_TAG_LI, "li")                         \
+  X(GUMBO_TAG_DL, "dl")                         \
+  X(GUMBO_TAG_DT, "dt")                         \
+  X(GUMBO_TAG_DD, "dd")                         \
+  X(GUMBO_TAG_FIGURE, "figure")                 \
+  X(GUMBO_TAG_FIGCAPTION, "figcaption")         \
+  X(GUMBO_TAG_MAIN, "main")                     \
+  X(GUMBO_TAG_DIV, "div")                       \
+  X(GUMBO_TAG_A, "a")                           \
+  X(GUMBO_TAG_EM, "em")                         \
+  X(GUMBO_TAG_STRONG, "strong")                 \
+  X(GUMBO_TAG_SMALL, "small")                   \
+  X(GUMBO_TAG_S, "s")                           \
+  X(GUMBO_TAG_CITE, "cite")                     \
+  X(GUMBO_TAG_Q, "q")                           \
+  X(GUMBO_TAG_DFN, "dfn")                       \
+  X(GUMBO_TAG_ABBR, "abbr")                     \
+  X(GUMBO_TAG_DATA, "data")                     \
+  X(GUMBO_TAG_TIME, "time")                     \
+  X(GUMBO_TAG_CODE, "code")                     \
+  X(GUMBO_TAG_VAR, "var")                       \
+  X(GUMBO_TAG_SAMP, "samp")                     \
+  X(GUMBO_TAG_KBD, "kbd")                       \
+  X(GUMBO_TAG_SUB, "sub")                       \
+  X(GUMBO_TAG_SUP, "sup")                       \
+  X(GUMBO_TAG_I, "i")                           \
+  X(GUMBO_TAG_B, "b")                           \
+  X(GUMBO_TAG_U, "u")                           \
+  X(GUMBO_TAG_MARK, "mark")                     \
+  X(GUMBO_TAG_RUBY, "ruby")                     \
+  X(GUMBO_TAG_RT, "rt")                         \
+  X(GUMBO_TAG_RP, "rp")                         \
+  X(GUMBO_TAG_BDI, "bdi")                       \
+  X(GUMBO_TAG_BDO, "bdo")                       \
+  X(GUMBO_TAG_SPAN, "span")                     \
+  X(GUMBO_TAG_BR, "br")                         \
+  X(GUMBO_TAG_WBR, "wbr")                       \
+  X(GUMBO_TAG_INS, "ins")                       \
+  X(GUMBO_TAG_DEL, "del")                       \
+  X(GUMBO_TAG_IMAGE, "image")                   \
+  X(GUMBO_TAG_IMG, "img")                       \
+  X(GUMBO_TAG_IFRAME, "iframe")                 \
+  X(GUMBO_TAG_EMBED, "embed")                   \
+  X(GUMBO_TAG_OBJECT, "object")                 \
+  X(GUMBO_TAG_PARAM, "param")                   \
+  X(GUMBO_TAG_VIDEO, "video")                   \
+  X(GUMBO_TAG_AUDIO, "audio")                   \
+  X(GUMBO_TAG_SOURCE, "source")                 \
+  X(GUMBO_TAG_TRACK, "track")                   \
+  X(GUMBO_TAG_CANVAS, "canvas")                 \
+  X(GUMBO_TAG_MAP, "map")                       \
+  X(GUMBO_TAG_AREA, "area")                     \
+  X(GUMBO_TAG_MATH, "math")                     \
+  X(GUMBO_TAG_MI, "mi")                         \
+  X(GUMBO_TAG_MO, "mo")                         \
+  X(GUMBO_TAG_MN, "mn")                         \
+  X(GUMBO_TAG_MS, "ms")                         \
+  X(GUMBO_TAG_MTEXT, "mtext")                   \
+  X(GUMBO_TAG_MGLYPH, "mglyph")                 \
+  X(GUMBO_TAG_MALIGNMARK, "malignmark")         \
+  X(GUMBO_TAG_ANNOTATION_XML, "annotation-xml") \
+  X(GUMBO_TAG_SVG, "svg")                       \
+  X(GUMBO_TAG_FOREIGNOBJECT, "foreignobject")   \
+  X(GUMBO_TAG_DESC, "desc")                     \
+  X(GUMBO_TAG_TABLE, "table")                   \
+  X(GUMBO_TAG_CAPTION, "caption")               \
+  X(GUMBO_TAG_COLGROUP, "colgroup")             \
+  X(GUMBO_TAG_COL, "col")                       \
+  X(GUMBO_TAG_TBODY, "tbody")                   \
+  X(GUMBO_TAG_THEAD, "thead")                   \
+  X(GUMBO_TAG_TFOOT, "tfoot")                   \
+  X(GUMBO_TAG_TR, "tr")                         \
+  X(GUMBO_TAG_TD, "td")                         \
+  X(GUMBO_TAG_TH, "th")                         \
+  X(GUMBO_TAG_FORM, "form")                     \
+  X(GUMBO_TAG_FIELDSET, "fieldset")             \
+  X(GUMBO_TAG_LEGEND, "legend")                 \
+  X(GUMBO_TAG_LABEL, "label")                   \
+  X(GUMBO_TAG_INPUT, "input")                   \
+  X(GUMBO_TAG_BUTTON, "button")                 \
+  X(GUMBO_TAG_SELECT, "select")                 \
+  X(GUMBO_TAG_DATALIST, "datalist")             \
+  X(GUMBO_TAG_OPTGROUP, "optgroup")             \
+  X(GUMBO_TAG_OPTION, "option")                 \
+  X(GUMBO_TAG_TEXTAREA, "textarea")             \
+  X(GUMBO_TAG_KEYGEN, "keygen")                 \
+  X(GUMBO_TAG_OUTPUT, "output")                 \
+  X(GUMBO_TAG_PROGRESS, "progress")             \
+  X(GUMBO_TAG_METER, "meter")                   \
+  X(GUMBO_TAG_DETAILS, "details")               \
+  X(GUMBO_TAG_SUMMARY, "summary")               \
+  X(GUMBO_TAG_MENU, "menu")                     \
+  X(GUMBO_TAG_MENUITEM, "menuitem")             \
+  X(GUMBO_TAG_APPLET, "applet")                 \
+  X(GUMBO_TAG_ACRONYM, "acronym")               \
+  X(GUMBO_TAG_BGSOUND, "bgsound")               \
+  X(GUMBO_TAG_DIR, "dir")                       \
+  X(GUMBO_TAG_FRAME, "frame")                   \
+  X(GUMBO_TAG_FRAMESET, "frameset")             \
+  X(GUMBO_TAG_NOFRAMES, "noframes")             \
+  X(GUMBO_TAG_LISTING, "listing")               \
+  X(GUMBO_TAG_XMP, "xmp")                       \
+  X(GUMBO_TAG_NEXTID, "nextid")                 \
+  X(GUMBO_TAG_NOEMBED, "noembed")               \
+  X(GUMBO_TAG_PLAINTEXT, "plaintext")           \
+  X(GUMBO_TAG_RB, "rb")                         \
+  X(GUMBO_TAG_STRIKE, "strike")                 \
+  X(GUMBO_TAG_BASEFONT, "basefont")             \
+  X(GUMBO_TAG_BIG, "big")                       \
+  X(GUMBO_TAG_BLINK, "blink")                   \
+  X(GUMBO_TAG_CENTER, "center")                 \
+  X(GUMBO_TAG_FONT, "font")                     \
+  X(GUMBO_TAG_MARQUEE, "marquee")               \
+  X(GUMBO_TAG_MULTICOL, "multicol")             \
+  X(GUMBO_TAG_NOBR, "nobr")                     \
+  X(GUMBO_TAG_SPACER, "spacer")                 \
+  X(GUMBO_TAG_TT, "tt")                         \
+  X(GUMBO_TAG_RTC, "rtc")                       \
+  X(GUMBO_TAG_DIALOG, "dialog")                 \
+  X(GUMBO_TAG_UNKNOWN, "")                      \
+  X(GUMBO_TAG_LAST, "")
+
+#define TAG_NAME(tag, name) [tag] = name,
 static const char kGumboTagNames[GUMBO_TAG_LAST+1][15] = {
-    [GUMBO_TAG_HTML] = "html",
-    [GUMBO_TAG_HEAD] = "head",
-    [GUMBO_TAG_TITLE] = "title",
-    [GUMBO_TAG_BASE] = "base",
-    [GUMBO_TAG_LINK] = "link",
-    [GUMBO_TAG_META] = "meta",
-    [GUMBO_TAG_STYLE] = "style",
-    [GUMBO_TAG_SCRIPT] = "script",
-    [GUMBO_TAG_NOSCRIPT] = "noscript",
-    [GUMBO_TAG_TEMPLATE] = "template",
-    [GUMBO_TAG_BODY] = "body",
-    [GUMBO_TAG_ARTICLE] = "article",
-    [GUMBO_TAG_SECTION] = "section",
-    [GUMBO_TAG_NAV] = "nav",
-    [GUMBO_TAG_ASIDE] = "aside",
-    [GUMBO_TAG_H1] = "h1",
-    [GUMBO_TAG_H2] = "h2",
-    [GUMBO_TAG_H3] = "h3",
-    [GUMBO_TAG_H4] = "h4",
-    [GUMBO_TAG_H5] = "h5",
-    [GUMBO_TAG_H6] = "h6",
-    [GUMBO_TAG_HGROUP] = "hgroup",
-    [GUMBO_TAG_HEADER] = "header",
-    [GUMBO_TAG_FOOTER] = "footer",
-    [GUMBO_TAG_ADDRESS] = "address",
-    [GUMBO_TAG_P] = "p",
-    [GUMBO_TAG_HR] = "hr",
-    [GUMBO_TAG_PRE] = "pre",
-    [GUMBO_TAG_BLOCKQUOTE] = "blockquote",
-    [GUMBO_TAG_OL] = "ol",
-    [GUMBO_TAG_UL] = "ul",
-    [GUMBO_TAG_LI] = "li",
-    [GUMBO_TAG_DL] = "dl",
-    [GUMBO_TAG_DT] = "dt",
-    [GUMBO_TAG_DD] = "dd",
-    [GUMBO_TAG_FIGURE] = "figure",
-    [GUMBO_TAG_FIGCAPTION] = "figcaption",
-    [GUMBO_TAG_MAIN] = "main",
-    [GUMBO_TAG_DIV] = "div",
-    [GUMBO_TAG_A] = "a",
-    [GUMBO_TAG_EM] = "em",
-    [GUMBO_TAG_STRONG] = "strong",
-    [GUMBO_TAG_SMALL] = "small",
-    [GUMBO_TAG_S] = "s",
-    [GUMBO_TAG_CITE] = "cite",
-    [GUMBO_TAG_Q] = "q",
-    [GUMBO_TAG_DFN] = "dfn",
-    [GUMBO_TAG_ABBR] = "abbr",
-    [GUMBO_TAG_DATA] = "data",
-    [GUMBO_TAG_TIME] = "time",
-    [GUMBO_TAG_CODE] = "code",
-    [GUMBO_TAG_VAR] = "var",
-    [GUMBO_TAG_SAMP] = "samp",
-    [GUMBO_TAG_KBD] = "kbd",
-    [GUMBO_TAG_SUB] = "sub",
-    [GUMBO_TAG_SUP] = "sup",
-    [GUMBO_TAG_I] = "i",
-    [GUMBO_TAG_B] = "b",
-    [GUMBO_TAG_U] = "u",
-    [GUMBO_TAG_MARK] = "mark",
-    [GUMBO_TAG_RUBY] = "ruby",
-    [GUMBO_TAG_RT] = "rt",
-    [GUMBO_TAG_RP] = "rp",
-    [GUMBO_TAG_BDI] = "bdi",
-    [GUMBO_TAG_BDO] = "bdo",
-    [GUMBO_TAG_SPAN] = "span",
-    [GUMBO_TAG_BR] = "br",
-    [GUMBO_TAG_WBR] = "wbr",
-    [GUMBO_TAG_INS] = "ins",
-    [GUMBO_TAG_DEL] = "del",
-    [GUMBO_TAG_IMAGE] = "image",
-    [GUMBO_TAG_IMG] = "img",
-    [GUMBO_TAG_IFRAME] = "iframe",
-    [GUMBO_TAG_EMBED] = "embed",
-    [GUMBO_TAG_OBJECT] = "object",
-    [GUMBO_TAG_PARAM] = "param",
-    [GUMBO_TAG_VIDEO] = "video",
-    [GUMBO_TAG_AUDIO] = "audio",
-    [GUMBO_TAG_SOURCE] = "source",
-    [GUMBO_TAG_TRACK] = "track",
-    [GUMBO_TAG_CANVAS] = "canvas",
-    [GUMBO_TAG_MAP] = "map",
-    [GUMBO_TAG_AREA] = "area",
-    [GUMBO_TAG_MATH] = "math",
-    [GUMBO_TAG_MI] = "mi",
-    [GUMBO_TAG_MO] = "mo",
-    [GUMBO_TAG_MN] = "mn",
-    [GUMBO_TAG_MS] = "ms",
-    [GUMBO_TAG_MTEXT] = "mtext",
-    [GUMBO_TAG_MGLYPH] = "mglyph",
-    [GUMBO_TAG_MALIGNMARK] = "malignmark",
-    [GUMBO_TAG_ANNOTATION_XML] = "annotation-xml",
-    [GUMBO_TAG_SVG] = "svg",
-    [GUMBO_TAG_FOREIGNOBJECT] = "foreignobject",
-    [GUMBO_TAG_DESC] = "desc",
-    [GUMBO_TAG_TABLE] = "table",
-    [GUMBO_TAG_CAPTION] = "caption",
-    [GUMBO_TAG_COLGROUP] = "colgroup",
-    [GUMBO_TAG_COL] = "col",
-    [GUMBO_TAG_TBODY] = "tbody",
-    [GUMBO_TAG_THEAD] = "thead",
-    [GUMBO_TAG_TFOOT] = "tfoot",
-    [GUMBO_TAG_TR] = "tr",
-    [GUMBO_TAG_TD] = "td",
-    [GUMBO_TAG_TH] = "th",
-    [GUMBO_TAG_FORM] = "form",
-    [GUMBO_TAG_FIELDSET] = "fieldset",
-    [GUMBO_TAG_LEGEND] = "legend",
-    [GUMBO_TAG_LABEL] = "label",
-    [GUMBO_TAG_INPUT] = "input",
-    [GUMBO_TAG_BUTTON] = "button",
-    [GUMBO_TAG_SELECT] = "select",
-    [GUMBO_TAG_DATALIST] = "datalist",
-    [GUMBO_TAG_OPTGROUP] = "optgroup",
-    [GUMBO_TAG_OPTION] = "option",
-    [GUMBO_TAG_TEXTAREA] = "textarea",
-    [GUMBO_TAG_KEYGEN] = "keygen",
-    [GUMBO_TAG_OUTPUT] = "output",
-    [GUMBO_TAG_PROGRESS] = "progress",
-    [GUMBO_TAG_METER] = "meter",
-    [GUMBO_TAG_DETAILS] = "details",
-    [GUMBO_TAG_SUMMARY] = "summary",
-    [GUMBO_TAG_MENU] = "menu",
-    [GUMBO_TAG_MENUITEM] = "menuitem",
-    [GUMBO_TAG_APPLET] = "applet",
-    [GUMBO_TAG_ACRONYM] = "acronym",
-    [GUMBO_TAG_BGSOUND] = "bgsound",
-    [GUMBO_TAG_DIR] = "dir",
-    [GUMBO_TAG_FRAME] = "frame",
-    [GUMBO_TAG_FRAMESET] = "frameset",
-    [GUMBO_TAG_NOFRAMES] = "noframes",
-    [GUMBO_TAG_LISTING] = "listing",
-    [GUMBO_TAG_XMP] = "xmp",
-    [GUMBO_TAG_NEXTID] = "nextid",
-    [GUMBO_TAG_NOEMBED] = "noembed",
-    [GUMBO_TAG_PLAINTEXT] = "plaintext",
-    [GUMBO_TAG_RB] = "rb",
-    [GUMBO_TAG_STRIKE] = "strike",
-    [GUMBO_TAG_BASEFONT] = "basefont",
-    [GUMBO_TAG_BIG] = "big",
-    [GUMBO_TAG_BLINK] = "blink",
-    [GUMBO_TAG_CENTER] = "center",
-    [GUMBO_TAG_FONT] = "font",
-    [GUMBO_TAG_MARQUEE] = "marquee",
-    [GUMBO_TAG_MULTICOL] = "multicol",
-    [GUMBO_TAG_NOBR] = "nobr",
-    [GUMBO_TAG_SPACER] = "spacer",
-    [GUMBO_TAG_TT] = "tt",
-    [GUMBO_TAG_RTC] = "rtc",
-    [GUMBO_TAG_DIALOG] = "dialog",
+  GUMBO_TAG_NAMES(TAG_NAME)
+};
+#undef TAG_NAME
 
-    [GUMBO_TAG_UNKNOWN] = "",
-    [GUMBO_TAG_LAST] = "",
+#define TAG_NAME_LENGTH(tag, name) [tag] = sizeof(name) - 1,
+static const unsigned char kGumboTagNameLengths[GUMBO_TAG_LAST+1] = {
+  GUMBO_TAG_NAMES(TAG_NAME_LENGTH)
 };
+#undef TAG_NAME_LENGTH
 
 const char* gumbo_normalized_tagname(GumboTag tag) {
   assert(tag <= GUMBO_TAG_LAST);
@@ -184,6 +196,11 @@ const char* gumbo_normalized_tagname(GumboTag tag) {
   return tagname;
 }
 
+size_t gumbo_normalized_tagname_length(GumboTag tag) {
+  assert(tag <= GUMBO_TAG_LAST);
+  return kGumboTagNameLengths[tag];
+}
+
 void gumbo_tag_from_original_text(GumboStringPiece* text) {
   if (text->data == NULL) {
     return;
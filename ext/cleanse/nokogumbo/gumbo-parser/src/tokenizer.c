@@ -53,6 +53,7 @@
 #include "gumbo.h"
 #include "parser.h"
 #include "string_buffer.h"
+#include "structural.h"
 #include "token_type.h"
 #include "tokenizer_states.h"
 #include "utf8.h"
@@ -83,6 +84,10 @@ typedef struct GumboInternalTagState {
   // of the buffer.
   const char* _original_text;
 
+  // The run of input that the buffer's contents are identical to, if any
+  // (see gumbo_string_slice_extend).
+  GumboStringPiece _buffer_slice;
+
   // The current tag enum, computed once the tag name state has finished so that
   // the buffer can be re-used for building up attributes.
   GumboTag _tag;
@@ -100,6 +105,15 @@ typedef struct GumboInternalTagState {
   // values are filled in by operating on _attributes.data[attributes.length-1].
   GumboVector /* GumboAttribute */ _attributes;
 
+  // An open-addressed hash table of the names in _attributes, used to find
+  // duplicates once a tag has ATTRIBUTE_INDEX_THRESHOLD attributes. Each slot
+  // holds an attribute's index plus one, or zero if it's empty. The table is
+  // reused from tag to tag; _indexed_attributes is the number of the current
+  // tag's attributes that have been added to it.
+  uint32_t* _attribute_index;
+  unsigned int _attribute_index_capacity;
+  unsigned int _indexed_attributes;
+
   // If true, the next attribute value to be finished should be dropped. This
   // happens if a duplicate attribute name is encountered - we want to consume
   // the attribute value, but shouldn't overwrite the existing value.
@@ -134,6 +148,10 @@ typedef struct GumboInternalTokenizerState {
   // checked in the markup declaration state.
   bool _is_adjusted_current_node_foreign;
 
+  // Whether the next token may be a character run. This is set by
+  // gumbo_tokenizer_set_allow_character_runs.
+  bool _allow_character_runs;
+
   // A flag indicating whether the tokenizer is in a CDATA section. If so, then
   // text tokens emitted will be GUMBO_TOKEN_CDATA.
   bool _is_in_cdata;
@@ -192,6 +210,10 @@ typedef struct GumboInternalTokenizerState {
 
   // The UTF8Iterator over the tokenizer input.
   Utf8Iterator _input;
+
+  // Stop bytes of the input, if GumboOptions.structural_index is set. See
+  // structural.h.
+  GumboStructuralIndex _structural_index;
 } GumboTokenizerState;
 
 // Adds a parse error to the parser's error struct.
@@ -351,11 +373,10 @@ static void reset_tag_buffer_start_point(GumboParser* parser) {
 }
 
 // Moves the temporary buffer contents over to the specified output string,
-// and clears the temporary buffer.
+// leaving the temporary buffer empty.
 static void finish_temporary_buffer(GumboParser* parser, const char** output) {
   GumboTokenizerState* tokenizer = parser->_tokenizer_state;
-  *output = gumbo_string_buffer_to_string(&tokenizer->_temporary_buffer);
-  clear_temporary_buffer(parser);
+  *output = gumbo_string_buffer_release(&tokenizer->_temporary_buffer);
 }
 
 // Advances the iterator past the end of the token, and then fills in the
@@ -373,6 +394,11 @@ static void finish_token(GumboParser* parser, GumboToken* token) {
   }
 
   token->position = tokenizer->_token_start_pos;
+  if (!tokenizer->_input._positions) {
+    token->original_text = kGumboEmptyString;
+    reset_token_start_point(tokenizer);
+    return;
+  }
   token->original_text.data = tokenizer->_token_start;
   reset_token_start_point(tokenizer);
   token->original_text.length =
@@ -386,6 +412,20 @@ static void finish_token(GumboParser* parser, GumboToken* token) {
     // \r off.
     --token->original_text.length;
   }
+  if (tokenizer->_input._strip) {
+    // Likewise, the next token may start after some bytes the iterator
+    // skipped (possibly around that \r), which aren't part of this one.
+    const char* data = token->original_text.data;
+    size_t length = token->original_text.length;
+    while (
+      length > 0
+      && (data[length - 1] == '\r'
+          || utf8_is_stripped_byte((unsigned char) data[length - 1]))
+    ) {
+      --length;
+    }
+    token->original_text.length = length;
+  }
 }
 
 // Records the doctype public ID, assumed to be in the temporary buffer.
@@ -416,6 +456,110 @@ static StateResult emit_char(GumboParser* parser, int c, GumboToken* output) {
   return EMIT_TOKEN;
 }
 
+// If the current character 'c' is the plain ASCII byte under the cursor and
+// the structural index has been built, returns the position of the next stop
+// byte after it, so that a state that only stops at stop bytes can consume
+// everything in between at once. Otherwise returns NULL.
+static const char* next_structural_stop(GumboTokenizerState* tokenizer, int c) {
+  if (
+    !gumbo_structural_index_is_built(&tokenizer->_structural_index)
+    || tokenizer->_reconsume_current_input
+  ) {
+    return NULL;
+  }
+  const Utf8Iterator* input = &tokenizer->_input;
+  const char* start = utf8iterator_get_char_pointer(input);
+  if (start >= utf8iterator_get_end_pointer(input) || c != (unsigned char) *start)
+    return NULL;
+  return gumbo_structural_index_next(&tokenizer->_structural_index, start + 1);
+}
+
+// Consumes the ordinary characters from the current character 'c' up to (but
+// not including) 'stop' into 'text'. The current character becomes the last
+// one of them, so the main loop advances past it as usual.
+static void consume_span(
+  GumboTokenizerState* tokenizer,
+  const char* stop,
+  GumboStringPiece* text
+) {
+  Utf8Iterator* input = &tokenizer->_input;
+  text->data = utf8iterator_get_char_pointer(input);
+  text->length = stop - text->data;
+  utf8iterator_next_ascii(input, text->length - 1);
+}
+
+// Classes of bytes that may appear in a character run. Everything else ends
+// the run: markup ('<' and '&'), NUL, carriage returns (which need newline
+// normalization), and any byte that isn't plain ASCII, which may need
+// decoding or a parse error.
+enum {
+  RUN_END = 0,
+  RUN_WHITESPACE = 1,
+  RUN_TEXT = 2,
+};
+
+static inline unsigned int character_run_class(unsigned char c) {
+  if (c > ' ' && c < 0x7F && c != '<' && c != '&')
+    return RUN_TEXT;
+  if (c == ' ' || c == '\t' || c == '\n' || c == '\f')
+    return RUN_WHITESPACE;
+  return RUN_END;
+}
+
+// Emits the ordinary text starting at the current character 'c' as a single
+// character run token, if the parser allows it and there are at least two
+// characters of it; otherwise emits just 'c', like emit_char.
+// Always returns EMIT_TOKEN.
+static StateResult emit_char_or_run(GumboParser* parser, int c, GumboToken* output) {
+  GumboTokenizerState* tokenizer = parser->_tokenizer_state;
+  if (!tokenizer->_allow_character_runs || tokenizer->_reconsume_current_input)
+    return emit_char(parser, c, output);
+
+  Utf8Iterator* input = &tokenizer->_input;
+  const unsigned char* start =
+    (const unsigned char*) utf8iterator_get_char_pointer(input);
+  const unsigned char* end =
+    (const unsigned char*) utf8iterator_get_end_pointer(input);
+  const unsigned char* run = start;
+  unsigned int classes = 0;
+
+  // The current character must be the byte under the cursor (it isn't, for
+  // instance, when it is a replacement character for an invalid byte).
+  if (start >= end || c != *start || character_run_class(*start) == RUN_END)
+    return emit_char(parser, c, output);
+
+  if (gumbo_structural_index_is_built(&tokenizer->_structural_index)) {
+    // Hop from stop byte to stop byte; some of them ('-' and the quotes) are
+    // ordinary text here.
+    const char* stop = next_structural_stop(tokenizer, c);
+    while (stop < (const char*) end && character_run_class(*stop) != RUN_END)
+      stop = gumbo_structural_index_next(&tokenizer->_structural_index, stop + 1);
+    run = (const unsigned char*) stop;
+    // The index doesn't tell whitespace from text, but text almost always
+    // shows up within the first few bytes.
+    for (const unsigned char* p = start; p < run && !classes; ++p)
+      classes = character_run_class(*p) & RUN_TEXT;
+  } else {
+    for (; run < end; ++run) {
+      unsigned int run_class = character_run_class(*run);
+      if (run_class == RUN_END)
+        break;
+      classes |= run_class;
+    }
+  }
+  if (run - start < 2)
+    return emit_char(parser, c, output);
+
+  output->type = GUMBO_TOKEN_CHARACTER_RUN;
+  output->v.character_run.data = (const char*) start;
+  output->v.character_run.length = run - start;
+  output->v.character_run.is_whitespace = !(classes & RUN_TEXT);
+  // finish_token() advances past the last character of the run.
+  utf8iterator_next_ascii(input, run - start - 1);
+  finish_token(parser, output);
+  return EMIT_TOKEN;
+}
+
 // Writes a replacement character token and records a parse error.
 // Always returns EMIT_TOKEN, per gumbo_lex return value.
 static StateResult emit_replacement_char(
@@ -491,9 +635,13 @@ static StateResult emit_current_tag(GumboParser* parser, GumboToken* output) {
     (int) output->original_text.length,
     output->original_text.data
   );
-  assert(output->original_text.length >= 2);
-  assert(output->original_text.data[0] == '<');
-  assert(output->original_text.data[output->original_text.length - 1] == '>');
+  // Without source positions, tokens have no original text to check.
+  assert(!output->original_text.data || output->original_text.length >= 2);
+  assert(!output->original_text.data || output->original_text.data[0] == '<');
+  assert (
+    !output->original_text.data
+    || output->original_text.data[output->original_text.length - 1] == '>'
+  );
   return EMIT_TOKEN;
 }
 
@@ -577,11 +725,20 @@ static void append_char_to_tag_buffer (
   int codepoint,
   bool reinitilize_position_on_first
 ) {
-  GumboStringBuffer* buffer = &parser->_tokenizer_state->_tag_state._buffer;
+  GumboTokenizerState* tokenizer = parser->_tokenizer_state;
+  GumboStringBuffer* buffer = &tokenizer->_tag_state._buffer;
   if (buffer->length == 0 && reinitilize_position_on_first) {
     reset_tag_buffer_start_point(parser);
   }
+  size_t length = buffer->length;
   gumbo_string_buffer_append_codepoint(codepoint, buffer);
+  gumbo_string_slice_extend (
+    &tokenizer->_tag_state._buffer_slice,
+    utf8iterator_get_char_pointer(&tokenizer->_input),
+    utf8iterator_get_end_pointer(&tokenizer->_input),
+    buffer->data + length,
+    buffer->length - length
+  );
 }
 
 // Like above but append a string.
@@ -590,11 +747,20 @@ static void append_string_to_tag_buffer (
   GumboStringPiece* str,
   bool reinitilize_position_on_first
 ) {
-  GumboStringBuffer* buffer = &parser->_tokenizer_state->_tag_state._buffer;
+  GumboTokenizerState* tokenizer = parser->_tokenizer_state;
+  GumboStringBuffer* buffer = &tokenizer->_tag_state._buffer;
   if (buffer->length == 0 && reinitilize_position_on_first) {
     reset_tag_buffer_start_point(parser);
   }
   gumbo_string_buffer_append_string(str, buffer);
+  // The string is always a span of the input.
+  gumbo_string_slice_extend (
+    &tokenizer->_tag_state._buffer_slice,
+    str->data,
+    utf8iterator_get_end_pointer(&tokenizer->_input),
+    str->data,
+    str->length
+  );
 }
 
 // (Re-)initialize the tag buffer. This also resets the original_text pointer
@@ -604,6 +770,7 @@ static void initialize_tag_buffer(GumboParser* parser) {
   GumboTagState* tag_state = &tokenizer->_tag_state;
 
   gumbo_string_buffer_init(&tag_state->_buffer);
+  tag_state->_buffer_slice = kGumboEmptyString;
   reset_tag_buffer_start_point(parser);
 }
 
@@ -631,12 +798,21 @@ static StateResult flush_code_points_consumed_as_character_reference (
   GumboTokenizerState* tokenizer = parser->_tokenizer_state;
   if (character_reference_part_of_attribute(parser)) {
     const char *start = utf8iterator_get_mark_pointer(&tokenizer->_input);
+    const char *end = utf8iterator_get_char_pointer(&tokenizer->_input);
     assert(start);
+    bool unquoted = tokenizer->_return_state == GUMBO_LEX_ATTR_VALUE_UNQUOTED;
+    if (parser->_options->strip_disallowed_bytes) {
+      // The raw input may contain bytes the iterator skipped over.
+      for (const char *c = start; c < end; ++c) {
+        if (!utf8_is_stripped_byte((unsigned char) *c))
+          append_char_to_tag_buffer(parser, (unsigned char) *c, unquoted);
+      }
+      return CONTINUE;
+    }
     GumboStringPiece str = {
       .data = start,
-      .length = utf8iterator_get_char_pointer(&tokenizer->_input) - start,
+      .length = end - start,
     };
-    bool unquoted = tokenizer->_return_state == GUMBO_LEX_ATTR_VALUE_UNQUOTED;
     append_string_to_tag_buffer(parser, &str, unquoted);
     return CONTINUE;
   }
@@ -670,6 +846,25 @@ static StateResult flush_char_ref (
   return emit_char(parser, first, output);
 }
 
+// Empties the attribute index for a new tag. Clearing costs time in proportion
+// to the table's size, so a table that was grown for some earlier, much larger
+// tag is released rather than cleared.
+static void reset_attribute_index(GumboTagState* tag_state) {
+  if (tag_state->_indexed_attributes == 0)
+    return;
+  if (tag_state->_attribute_index_capacity > 8 * tag_state->_indexed_attributes) {
+    gumbo_free(tag_state->_attribute_index);
+    tag_state->_attribute_index = NULL;
+    tag_state->_attribute_index_capacity = 0;
+  } else {
+    memset (
+      tag_state->_attribute_index,
+      0,
+      tag_state->_attribute_index_capacity * sizeof(uint32_t)
+    );
+  }
+  tag_state->_indexed_attributes = 0;
+}
 
 // Initializes the tag_state to start a new tag, keeping track of the opening
 // positions and original text. Takes a boolean indicating whether this is a
@@ -691,17 +886,23 @@ static void start_new_tag(GumboParser* parser, bool is_start_tag) {
   // numbers are a bit higher for more modern websites (eg. ~45% = 0, ~40% = 1
   // for the HTML5 Spec), but still have basically 99% of nodes with <= 2 attrs.
   gumbo_vector_init(1, &tag_state->_attributes);
+  reset_attribute_index(tag_state);
   tag_state->_drop_next_attr_value = false;
   tag_state->_is_start_tag = is_start_tag;
   tag_state->_is_self_closing = false;
   gumbo_debug("Starting new tag.\n");
 }
 
-// Fills in the specified char* with the contents of the tag buffer.
-static void copy_over_tag_buffer(GumboParser* parser, const char** output) {
+// Moves the contents of the tag buffer over to the specified char*, leaving
+// the tag buffer empty (but not resetting its start point). Returns the
+// length of the string.
+static size_t move_over_tag_buffer(GumboParser* parser, const char** output) {
   GumboTokenizerState* tokenizer = parser->_tokenizer_state;
   GumboTagState* tag_state = &tokenizer->_tag_state;
-  *output = gumbo_string_buffer_to_string(&tag_state->_buffer);
+  size_t length = tag_state->_buffer.length;
+  *output = gumbo_string_buffer_release(&tag_state->_buffer);
+  tag_state->_buffer_slice = kGumboEmptyString;
+  return length;
 }
 
 // Fills in:
@@ -719,6 +920,12 @@ static void copy_over_original_tag_text (
   GumboTokenizerState* tokenizer = parser->_tokenizer_state;
   GumboTagState* tag_state = &tokenizer->_tag_state;
 
+  if (!tokenizer->_input._positions) {
+    *original_text = kGumboEmptyString;
+    *start_pos = kGumboEmptySourcePosition;
+    *end_pos = kGumboEmptySourcePosition;
+    return;
+  }
   original_text->data = tag_state->_original_text;
   original_text->length = utf8iterator_get_char_pointer(&tokenizer->_input) -
                           tag_state->_original_text;
@@ -752,12 +959,12 @@ static void finish_tag_name(GumboParser* parser) {
   size_t length = tag_state->_buffer.length;
   tag_state->_tag = gumbo_tagn_enum(data, length);
   if (tag_state->_tag == GUMBO_TAG_UNKNOWN) {
-    char *name = gumbo_alloc(length + 1);
-    memcpy(name, data, length);
-    name[length] = 0;
-    tag_state->_name = name;
+    tag_state->_name = gumbo_string_buffer_release(&tag_state->_buffer);
+  } else {
+    gumbo_string_buffer_clear(&tag_state->_buffer);
   }
-  reinitialize_tag_buffer(parser);
+  tag_state->_buffer_slice = kGumboEmptyString;
+  reset_tag_buffer_start_point(parser);
 }
 
 // Adds an ERR_DUPLICATE_ATTR parse error to the parser's error struct.
@@ -776,6 +983,63 @@ static void add_duplicate_attr_error(GumboParser* parser) {
   error->v.tokenizer.state = tokenizer->_state;
 }
 
+// Tags with fewer attributes than this are checked for duplicate names with a
+// linear scan; beyond it, the names are looked up in _attribute_index so that
+// the cost per tag stays linear in the number of attributes.
+#define ATTRIBUTE_INDEX_THRESHOLD 16
+
+static uint32_t hash_attribute_name(const char* name, size_t length) {
+  // FNV-1a.
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= (unsigned char) name[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// Returns the slot of the attribute index that holds the attribute named
+// `name`, or else the empty slot where it would go.
+static uint32_t* find_attribute_slot (
+  GumboTagState* tag_state,
+  const char* name,
+  size_t length
+) {
+  unsigned int mask = tag_state->_attribute_index_capacity - 1;
+  for (uint32_t hash = hash_attribute_name(name, length); ; ++hash) {
+    uint32_t* slot = &tag_state->_attribute_index[hash & mask];
+    if (*slot == 0)
+      return slot;
+    const GumboAttribute* attr = tag_state->_attributes.data[*slot - 1];
+    if (attr->name_length == length && 0 == memcmp(attr->name, name, length))
+      return slot;
+  }
+}
+
+// Adds any of the current tag's attributes that are missing from the index,
+// first growing it if needed to keep it at most half full (counting the one
+// attribute about to be added).
+static void update_attribute_index(GumboTagState* tag_state) {
+  const GumboVector* attributes = &tag_state->_attributes;
+  unsigned int needed = 2 * (attributes->length + 1);
+  if (needed > tag_state->_attribute_index_capacity) {
+    unsigned int capacity = 4 * ATTRIBUTE_INDEX_THRESHOLD;
+    while (capacity < needed)
+      capacity *= 2;
+    gumbo_free(tag_state->_attribute_index);
+    tag_state->_attribute_index = gumbo_alloc(capacity * sizeof(uint32_t));
+    memset(tag_state->_attribute_index, 0, capacity * sizeof(uint32_t));
+    tag_state->_attribute_index_capacity = capacity;
+    tag_state->_indexed_attributes = 0;
+  }
+  while (tag_state->_indexed_attributes < attributes->length) {
+    const GumboAttribute* attr =
+      attributes->data[tag_state->_indexed_attributes++];
+    *find_attribute_slot(tag_state, attr->name, attr->name_length) =
+      tag_state->_indexed_attributes;
+  }
+}
+
 // Creates a new attribute in the current tag, copying the current tag buffer to
 // the attribute's name. The attribute's value starts out as the empty string
 // (following the "Boolean attributes" section of the spec) and is only
@@ -800,27 +1064,41 @@ static void finish_attribute_name(GumboParser* parser) {
   assert(tag_state->_attributes.data);
   assert(tag_state->_attributes.capacity);
 
-  for (unsigned int i = 0; i < attributes->length; ++i) {
-    GumboAttribute* attr = attributes->data[i];
-    if (
-      strlen(attr->name) == tag_state->_buffer.length
-      && 0 == memcmp (
-        attr->name,
-        tag_state->_buffer.data,
-        tag_state->_buffer.length
-      )
-    ) {
-      // Identical attribute; bail.
-      add_duplicate_attr_error(parser);
-      reinitialize_tag_buffer(parser);
-      tag_state->_drop_next_attr_value = true;
-      return;
+  bool duplicate = false;
+  if (attributes->length < ATTRIBUTE_INDEX_THRESHOLD) {
+    for (unsigned int i = 0; i < attributes->length; ++i) {
+      GumboAttribute* attr = attributes->data[i];
+      if (
+        attr->name_length == tag_state->_buffer.length
+        && 0 == memcmp (
+          attr->name,
+          tag_state->_buffer.data,
+          tag_state->_buffer.length
+        )
+      ) {
+        duplicate = true;
+        break;
+      }
     }
+  } else {
+    update_attribute_index(tag_state);
+    duplicate = *find_attribute_slot (
+      tag_state,
+      tag_state->_buffer.data,
+      tag_state->_buffer.length
+    ) != 0;
+  }
+  if (duplicate) {
+    // Identical attribute; bail.
+    add_duplicate_attr_error(parser);
+    reinitialize_tag_buffer(parser);
+    tag_state->_drop_next_attr_value = true;
+    return;
   }
 
   GumboAttribute* attr = gumbo_alloc(sizeof(GumboAttribute));
   attr->attr_namespace = GUMBO_ATTR_NAMESPACE_NONE;
-  copy_over_tag_buffer(parser, &attr->name);
+  attr->name_length = move_over_tag_buffer(parser, &attr->name);
   copy_over_original_tag_text (
     parser,
     &attr->original_name,
@@ -828,6 +1106,8 @@ static void finish_attribute_name(GumboParser* parser) {
     &attr->name_end
   );
   attr->value = gumbo_strdup("");
+  attr->value_length = 0;
+  attr->borrowed_value = kGumboEmptyString;
   copy_over_original_tag_text (
     parser,
     &attr->original_value,
@@ -835,7 +1115,7 @@ static void finish_attribute_name(GumboParser* parser) {
     &attr->name_end
   );
   gumbo_vector_add(attr, attributes);
-  reinitialize_tag_buffer(parser);
+  reset_tag_buffer_start_point(parser);
 }
 
 // Finishes an attribute value. This sets the value of the most recently added
@@ -853,10 +1133,13 @@ static void finish_attribute_value(GumboParser* parser) {
   GumboAttribute* attr =
       tag_state->_attributes.data[tag_state->_attributes.length - 1];
   gumbo_free((void*) attr->value);
-  copy_over_tag_buffer(parser, &attr->value);
+  attr->borrowed_value = tag_state->_buffer_slice;
+  if (!attr->borrowed_value.data)
+    attr->borrowed_value = kGumboEmptyString;
+  attr->value_length = move_over_tag_buffer(parser, &attr->value);
   copy_over_original_tag_text(
       parser, &attr->original_value, &attr->value_start, &attr->value_end);
-  reinitialize_tag_buffer(parser);
+  reset_tag_buffer_start_point(parser);
 }
 
 // Returns true if the current end tag matches the last start tag emitted.
@@ -880,9 +1163,13 @@ void gumbo_tokenizer_state_init (
   tokenizer->_character_reference_code = 0;
   tokenizer->_reconsume_current_input = false;
   tokenizer->_is_adjusted_current_node_foreign = false;
+  tokenizer->_allow_character_runs = false;
   tokenizer->_is_in_cdata = false;
   tokenizer->_tag_state._last_start_tag = GUMBO_TAG_LAST;
   tokenizer->_tag_state._name = NULL;
+  tokenizer->_tag_state._attribute_index = NULL;
+  tokenizer->_tag_state._attribute_index_capacity = 0;
+  tokenizer->_tag_state._indexed_attributes = 0;
 
   tokenizer->_buffered_emit_char = kGumboNoChar;
   gumbo_string_buffer_init(&tokenizer->_temporary_buffer);
@@ -891,6 +1178,11 @@ void gumbo_tokenizer_state_init (
   mark_tag_state_as_empty(&tokenizer->_tag_state);
 
   utf8iterator_init(parser, text, text_length, &tokenizer->_input);
+  if (parser->_options->structural_index) {
+    gumbo_structural_index_init(&tokenizer->_structural_index, text, text_length);
+  } else {
+    tokenizer->_structural_index._bits = NULL;
+  }
   utf8iterator_get_position(&tokenizer->_input, &tokenizer->_token_start_pos);
   tokenizer->_token_start = utf8iterator_get_char_pointer(&tokenizer->_input);
   doc_type_state_init(parser);
@@ -904,6 +1196,9 @@ void gumbo_tokenizer_state_destroy(GumboParser* parser) {
   gumbo_string_buffer_destroy(&tokenizer->_temporary_buffer);
   assert(tokenizer->_tag_state._name == NULL);
   assert(tokenizer->_tag_state._attributes.data == NULL);
+  gumbo_free(tokenizer->_tag_state._attribute_index);
+  if (gumbo_structural_index_is_built(&tokenizer->_structural_index))
+    gumbo_structural_index_destroy(&tokenizer->_structural_index);
   gumbo_free(tokenizer);
 }
 
@@ -924,6 +1219,10 @@ void gumbo_tokenizer_set_is_adjusted_current_node_foreign (
   parser->_tokenizer_state->_is_adjusted_current_node_foreign = is_foreign;
 }
 
+void gumbo_tokenizer_set_allow_character_runs(GumboParser* parser, bool allow) {
+  parser->_tokenizer_state->_allow_character_runs = allow;
+}
+
 static void reconsume_in_state(GumboParser* parser, GumboTokenizerEnum state) {
   GumboTokenizerState* tokenizer = parser->_tokenizer_state;
   tokenizer->_reconsume_current_input = true;
@@ -953,7 +1252,7 @@ static StateResult handle_data_state (
     case -1:
       return emit_eof(parser, output);
     default:
-      return emit_char(parser, c, output);
+      return emit_char_or_run(parser, c, output);
   }
 }
 
@@ -979,7 +1278,7 @@ static StateResult handle_rcdata_state (
     case -1:
       return emit_eof(parser, output);
     default:
-      return emit_char(parser, c, output);
+      return emit_char_or_run(parser, c, output);
   }
 }
 
@@ -1000,7 +1299,7 @@ static StateResult handle_rawtext_state (
     case -1:
       return emit_eof(parser, output);
     default:
-      return emit_char(parser, c, output);
+      return emit_char_or_run(parser, c, output);
   }
 }
 
@@ -1021,7 +1320,7 @@ static StateResult handle_script_data_state (
     case -1:
       return emit_eof(parser, output);
     default:
-      return emit_char(parser, c, output);
+      return emit_char_or_run(parser, c, output);
   }
 }
 
@@ -1038,7 +1337,7 @@ static StateResult handle_plaintext_state (
     case -1:
       return emit_eof(parser, output);
     default:
-      return emit_char(parser, c, output);
+      return emit_char_or_run(parser, c, output);
   }
 }
 
@@ -1882,9 +2181,17 @@ static StateResult handle_attr_value_double_quoted_state (
       tokenizer_add_parse_error(parser, GUMBO_ERR_EOF_IN_TAG);
       abandon_current_tag(parser);
       return emit_eof(parser, output);
-    default:
-      append_char_to_tag_buffer(parser, c, false);
+    default: {
+      const char* stop = next_structural_stop(tokenizer, c);
+      if (stop) {
+        GumboStringPiece text;
+        consume_span(tokenizer, stop, &text);
+        append_string_to_tag_buffer(parser, &text, false);
+      } else {
+        append_char_to_tag_buffer(parser, c, false);
+      }
       return CONTINUE;
+    }
   }
 }
 
@@ -1912,9 +2219,17 @@ static StateResult handle_attr_value_single_quoted_state (
       tokenizer_add_parse_error(parser, GUMBO_ERR_EOF_IN_TAG);
       abandon_current_tag(parser);
       return emit_eof(parser, output);
-    default:
-      append_char_to_tag_buffer(parser, c, false);
+    default: {
+      const char* stop = next_structural_stop(tokenizer, c);
+      if (stop) {
+        GumboStringPiece text;
+        consume_span(tokenizer, stop, &text);
+        append_string_to_tag_buffer(parser, &text, false);
+      } else {
+        append_char_to_tag_buffer(parser, c, false);
+      }
       return CONTINUE;
+    }
   }
 }
 
@@ -2160,7 +2475,7 @@ static StateResult handle_comment_start_dash_state (
 // https://html.spec.whatwg.org/multipage/parsing.html#comment-state
 static StateResult handle_comment_state (
   GumboParser* parser,
-  GumboTokenizerState* UNUSED_ARG(tokenizer),
+  GumboTokenizerState* tokenizer,
   int c,
   GumboToken* output
 ) {
@@ -2181,9 +2496,17 @@ static StateResult handle_comment_state (
       // Switch to data to emit the EOF token next.
       reconsume_in_state(parser, GUMBO_LEX_DATA);
       return emit_comment(parser, output);
-    default:
-      append_char_to_temporary_buffer(parser, c);
+    default: {
+      const char* stop = next_structural_stop(tokenizer, c);
+      if (stop) {
+        GumboStringPiece text;
+        consume_span(tokenizer, stop, &text);
+        append_string_to_temporary_buffer(parser, &text);
+      } else {
+        append_char_to_temporary_buffer(parser, c);
+      }
       return CONTINUE;
+    }
   }
 }
 
@@ -3035,7 +3358,13 @@ static StateResult handle_named_character_reference_state (
 ) {
   const char *cur = utf8iterator_get_char_pointer(&tokenizer->_input);
   const char *end = utf8iterator_get_end_pointer(&tokenizer->_input);
+  char window[kGumboMaxNamedCharRefLength];
   int code_point[2];
+  if (parser->_options->strip_disallowed_bytes) {
+    // Match against the input as the iterator sees it, without skipped bytes.
+    cur = window;
+    end = window + utf8iterator_peek(&tokenizer->_input, window, sizeof(window));
+  }
   size_t size = match_named_char_ref(cur, end - cur, code_point);
 
   if (size > 0) {
@@ -3282,6 +3611,14 @@ static StateResult handle_numeric_character_reference_end_state (
   return flush_char_ref(parser, c, kGumboNoChar, output);
 }
 
+// Labels as values are a GNU extension; where they're available, gumbo_lex
+// jumps from state to state directly rather than calling through
+// dispatch_table. Define GUMBO_NO_COMPUTED_GOTO to use the table anyway.
+#if (GNUC_AT_LEAST(3, 0) || defined(__clang__)) \
+    && !defined(GUMBO_NO_COMPUTED_GOTO)
+# define GUMBO_COMPUTED_GOTO 1
+#endif
+
 typedef StateResult (*GumboLexerStateFunction) (
   GumboParser* parser,
   GumboTokenizerState* tokenizer,
@@ -3289,88 +3626,96 @@ typedef StateResult (*GumboLexerStateFunction) (
   GumboToken* output
 );
 
+// Every lexer state with the function that handles it.
+#define GUMBO_LEXER_STATES(X) \
+  X(GUMBO_LEX_DATA, handle_data_state) \
+  X(GUMBO_LEX_RCDATA, handle_rcdata_state) \
+  X(GUMBO_LEX_RAWTEXT, handle_rawtext_state) \
+  X(GUMBO_LEX_SCRIPT_DATA, handle_script_data_state) \
+  X(GUMBO_LEX_PLAINTEXT, handle_plaintext_state) \
+  X(GUMBO_LEX_TAG_OPEN, handle_tag_open_state) \
+  X(GUMBO_LEX_END_TAG_OPEN, handle_end_tag_open_state) \
+  X(GUMBO_LEX_TAG_NAME, handle_tag_name_state) \
+  X(GUMBO_LEX_RCDATA_LT, handle_rcdata_lt_state) \
+  X(GUMBO_LEX_RCDATA_END_TAG_OPEN, handle_rcdata_end_tag_open_state) \
+  X(GUMBO_LEX_RCDATA_END_TAG_NAME, handle_rcdata_end_tag_name_state) \
+  X(GUMBO_LEX_RAWTEXT_LT, handle_rawtext_lt_state) \
+  X(GUMBO_LEX_RAWTEXT_END_TAG_OPEN, handle_rawtext_end_tag_open_state) \
+  X(GUMBO_LEX_RAWTEXT_END_TAG_NAME, handle_rawtext_end_tag_name_state) \
+  X(GUMBO_LEX_SCRIPT_DATA_LT, handle_script_data_lt_state) \
+  X(GUMBO_LEX_SCRIPT_DATA_END_TAG_OPEN, handle_script_data_end_tag_open_state) \
+  X(GUMBO_LEX_SCRIPT_DATA_END_TAG_NAME, handle_script_data_end_tag_name_state) \
+  X(GUMBO_LEX_SCRIPT_DATA_ESCAPED_START, handle_script_data_escaped_start_state) \
+  X(GUMBO_LEX_SCRIPT_DATA_ESCAPED_START_DASH, handle_script_data_escaped_start_dash_state) \
+  X(GUMBO_LEX_SCRIPT_DATA_ESCAPED, handle_script_data_escaped_state) \
+  X(GUMBO_LEX_SCRIPT_DATA_ESCAPED_DASH, handle_script_data_escaped_dash_state) \
+  X(GUMBO_LEX_SCRIPT_DATA_ESCAPED_DASH_DASH, handle_script_data_escaped_dash_dash_state) \
+  X(GUMBO_LEX_SCRIPT_DATA_ESCAPED_LT, handle_script_data_escaped_lt_state) \
+  X(GUMBO_LEX_SCRIPT_DATA_ESCAPED_END_TAG_OPEN, handle_script_data_escaped_end_tag_open_state) \
+  X(GUMBO_LEX_SCRIPT_DATA_ESCAPED_END_TAG_NAME, handle_script_data_escaped_end_tag_name_state) \
+  X(GUMBO_LEX_SCRIPT_DATA_DOUBLE_ESCAPED_START, handle_script_data_double_escaped_start_state) \
+  X(GUMBO_LEX_SCRIPT_DATA_DOUBLE_ESCAPED, handle_script_data_double_escaped_state) \
+  X(GUMBO_LEX_SCRIPT_DATA_DOUBLE_ESCAPED_DASH, handle_script_data_double_escaped_dash_state) \
+  X(GUMBO_LEX_SCRIPT_DATA_DOUBLE_ESCAPED_DASH_DASH, handle_script_data_double_escaped_dash_dash_state) \
+  X(GUMBO_LEX_SCRIPT_DATA_DOUBLE_ESCAPED_LT, handle_script_data_double_escaped_lt_state) \
+  X(GUMBO_LEX_SCRIPT_DATA_DOUBLE_ESCAPED_END, handle_script_data_double_escaped_end_state) \
+  X(GUMBO_LEX_BEFORE_ATTR_NAME, handle_before_attr_name_state) \
+  X(GUMBO_LEX_ATTR_NAME, handle_attr_name_state) \
+  X(GUMBO_LEX_AFTER_ATTR_NAME, handle_after_attr_name_state) \
+  X(GUMBO_LEX_BEFORE_ATTR_VALUE, handle_before_attr_value_state) \
+  X(GUMBO_LEX_ATTR_VALUE_DOUBLE_QUOTED, handle_attr_value_double_quoted_state) \
+  X(GUMBO_LEX_ATTR_VALUE_SINGLE_QUOTED, handle_attr_value_single_quoted_state) \
+  X(GUMBO_LEX_ATTR_VALUE_UNQUOTED, handle_attr_value_unquoted_state) \
+  X(GUMBO_LEX_AFTER_ATTR_VALUE_QUOTED, handle_after_attr_value_quoted_state) \
+  X(GUMBO_LEX_SELF_CLOSING_START_TAG, handle_self_closing_start_tag_state) \
+  X(GUMBO_LEX_BOGUS_COMMENT, handle_bogus_comment_state) \
+  X(GUMBO_LEX_MARKUP_DECLARATION_OPEN, handle_markup_declaration_open_state) \
+  X(GUMBO_LEX_COMMENT_START, handle_comment_start_state) \
+  X(GUMBO_LEX_COMMENT_START_DASH, handle_comment_start_dash_state) \
+  X(GUMBO_LEX_COMMENT, handle_comment_state) \
+  X(GUMBO_LEX_COMMENT_LT, handle_comment_lt_state) \
+  X(GUMBO_LEX_COMMENT_LT_BANG, handle_comment_lt_bang_state) \
+  X(GUMBO_LEX_COMMENT_LT_BANG_DASH, handle_comment_lt_bang_dash_state) \
+  X(GUMBO_LEX_COMMENT_LT_BANG_DASH_DASH, handle_comment_lt_bang_dash_dash_state) \
+  X(GUMBO_LEX_COMMENT_END_DASH, handle_comment_end_dash_state) \
+  X(GUMBO_LEX_COMMENT_END, handle_comment_end_state) \
+  X(GUMBO_LEX_COMMENT_END_BANG, handle_comment_end_bang_state) \
+  X(GUMBO_LEX_DOCTYPE, handle_doctype_state) \
+  X(GUMBO_LEX_BEFORE_DOCTYPE_NAME, handle_before_doctype_name_state) \
+  X(GUMBO_LEX_DOCTYPE_NAME, handle_doctype_name_state) \
+  X(GUMBO_LEX_AFTER_DOCTYPE_NAME, handle_after_doctype_name_state) \
+  X(GUMBO_LEX_AFTER_DOCTYPE_PUBLIC_KEYWORD, handle_after_doctype_public_keyword_state) \
+  X(GUMBO_LEX_BEFORE_DOCTYPE_PUBLIC_ID, handle_before_doctype_public_id_state) \
+  X(GUMBO_LEX_DOCTYPE_PUBLIC_ID_DOUBLE_QUOTED, handle_doctype_public_id_double_quoted_state) \
+  X(GUMBO_LEX_DOCTYPE_PUBLIC_ID_SINGLE_QUOTED, handle_doctype_public_id_single_quoted_state) \
+  X(GUMBO_LEX_AFTER_DOCTYPE_PUBLIC_ID, handle_after_doctype_public_id_state) \
+  X(GUMBO_LEX_BETWEEN_DOCTYPE_PUBLIC_SYSTEM_ID, handle_between_doctype_public_system_id_state) \
+  X(GUMBO_LEX_AFTER_DOCTYPE_SYSTEM_KEYWORD, handle_after_doctype_system_keyword_state) \
+  X(GUMBO_LEX_BEFORE_DOCTYPE_SYSTEM_ID, handle_before_doctype_system_id_state) \
+  X(GUMBO_LEX_DOCTYPE_SYSTEM_ID_DOUBLE_QUOTED, handle_doctype_system_id_double_quoted_state) \
+  X(GUMBO_LEX_DOCTYPE_SYSTEM_ID_SINGLE_QUOTED, handle_doctype_system_id_single_quoted_state) \
+  X(GUMBO_LEX_AFTER_DOCTYPE_SYSTEM_ID, handle_after_doctype_system_id_state) \
+  X(GUMBO_LEX_BOGUS_DOCTYPE, handle_bogus_doctype_state) \
+  X(GUMBO_LEX_CDATA_SECTION, handle_cdata_section_state) \
+  X(GUMBO_LEX_CDATA_SECTION_BRACKET, handle_cdata_section_bracket_state) \
+  X(GUMBO_LEX_CDATA_SECTION_END, handle_cdata_section_end_state) \
+  X(GUMBO_LEX_CHARACTER_REFERENCE, handle_character_reference_state) \
+  X(GUMBO_LEX_NAMED_CHARACTER_REFERENCE, handle_named_character_reference_state) \
+  X(GUMBO_LEX_AMBIGUOUS_AMPERSAND, handle_ambiguous_ampersand_state) \
+  X(GUMBO_LEX_NUMERIC_CHARACTER_REFERENCE, handle_numeric_character_reference_state) \
+  X(GUMBO_LEX_HEXADECIMAL_CHARACTER_REFERENCE_START, handle_hexadecimal_character_reference_start_state) \
+  X(GUMBO_LEX_DECIMAL_CHARACTER_REFERENCE_START, handle_decimal_character_reference_start_state) \
+  X(GUMBO_LEX_HEXADECIMAL_CHARACTER_REFERENCE, handle_hexadecimal_character_reference_state) \
+  X(GUMBO_LEX_DECIMAL_CHARACTER_REFERENCE, handle_decimal_character_reference_state) \
+  X(GUMBO_LEX_NUMERIC_CHARACTER_REFERENCE_END, handle_numeric_character_reference_end_state)
+
+#ifndef GUMBO_COMPUTED_GOTO
+#define DISPATCH_ENTRY(state, handler) [state] = handler,
 static GumboLexerStateFunction dispatch_table[] = {
-  [GUMBO_LEX_DATA] = handle_data_state,
-  [GUMBO_LEX_RCDATA] = handle_rcdata_state,
-  [GUMBO_LEX_RAWTEXT] = handle_rawtext_state,
-  [GUMBO_LEX_SCRIPT_DATA] = handle_script_data_state,
-  [GUMBO_LEX_PLAINTEXT] = handle_plaintext_state,
-  [GUMBO_LEX_TAG_OPEN] = handle_tag_open_state,
-  [GUMBO_LEX_END_TAG_OPEN] = handle_end_tag_open_state,
-  [GUMBO_LEX_TAG_NAME] = handle_tag_name_state,
-  [GUMBO_LEX_RCDATA_LT] = handle_rcdata_lt_state,
-  [GUMBO_LEX_RCDATA_END_TAG_OPEN] = handle_rcdata_end_tag_open_state,
-  [GUMBO_LEX_RCDATA_END_TAG_NAME] = handle_rcdata_end_tag_name_state,
-  [GUMBO_LEX_RAWTEXT_LT] = handle_rawtext_lt_state,
-  [GUMBO_LEX_RAWTEXT_END_TAG_OPEN] = handle_rawtext_end_tag_open_state,
-  [GUMBO_LEX_RAWTEXT_END_TAG_NAME] = handle_rawtext_end_tag_name_state,
-  [GUMBO_LEX_SCRIPT_DATA_LT] = handle_script_data_lt_state,
-  [GUMBO_LEX_SCRIPT_DATA_END_TAG_OPEN] = handle_script_data_end_tag_open_state,
-  [GUMBO_LEX_SCRIPT_DATA_END_TAG_NAME] = handle_script_data_end_tag_name_state,
-  [GUMBO_LEX_SCRIPT_DATA_ESCAPED_START] = handle_script_data_escaped_start_state,
-  [GUMBO_LEX_SCRIPT_DATA_ESCAPED_START_DASH] = handle_script_data_escaped_start_dash_state,
-  [GUMBO_LEX_SCRIPT_DATA_ESCAPED] = handle_script_data_escaped_state,
-  [GUMBO_LEX_SCRIPT_DATA_ESCAPED_DASH] = handle_script_data_escaped_dash_state,
-  [GUMBO_LEX_SCRIPT_DATA_ESCAPED_DASH_DASH] = handle_script_data_escaped_dash_dash_state,
-  [GUMBO_LEX_SCRIPT_DATA_ESCAPED_LT] = handle_script_data_escaped_lt_state,
-  [GUMBO_LEX_SCRIPT_DATA_ESCAPED_END_TAG_OPEN] = handle_script_data_escaped_end_tag_open_state,
-  [GUMBO_LEX_SCRIPT_DATA_ESCAPED_END_TAG_NAME] = handle_script_data_escaped_end_tag_name_state,
-  [GUMBO_LEX_SCRIPT_DATA_DOUBLE_ESCAPED_START] = handle_script_data_double_escaped_start_state,
-  [GUMBO_LEX_SCRIPT_DATA_DOUBLE_ESCAPED] = handle_script_data_double_escaped_state,
-  [GUMBO_LEX_SCRIPT_DATA_DOUBLE_ESCAPED_DASH] = handle_script_data_double_escaped_dash_state,
-  [GUMBO_LEX_SCRIPT_DATA_DOUBLE_ESCAPED_DASH_DASH] = handle_script_data_double_escaped_dash_dash_state,
-  [GUMBO_LEX_SCRIPT_DATA_DOUBLE_ESCAPED_LT] = handle_script_data_double_escaped_lt_state,
-  [GUMBO_LEX_SCRIPT_DATA_DOUBLE_ESCAPED_END] = handle_script_data_double_escaped_end_state,
-  [GUMBO_LEX_BEFORE_ATTR_NAME] = handle_before_attr_name_state,
-  [GUMBO_LEX_ATTR_NAME] = handle_attr_name_state,
-  [GUMBO_LEX_AFTER_ATTR_NAME] = handle_after_attr_name_state,
-  [GUMBO_LEX_BEFORE_ATTR_VALUE] = handle_before_attr_value_state,
-  [GUMBO_LEX_ATTR_VALUE_DOUBLE_QUOTED] = handle_attr_value_double_quoted_state,
-  [GUMBO_LEX_ATTR_VALUE_SINGLE_QUOTED] = handle_attr_value_single_quoted_state,
-  [GUMBO_LEX_ATTR_VALUE_UNQUOTED] = handle_attr_value_unquoted_state,
-  [GUMBO_LEX_AFTER_ATTR_VALUE_QUOTED] = handle_after_attr_value_quoted_state,
-  [GUMBO_LEX_SELF_CLOSING_START_TAG] = handle_self_closing_start_tag_state,
-  [GUMBO_LEX_BOGUS_COMMENT] = handle_bogus_comment_state,
-  [GUMBO_LEX_MARKUP_DECLARATION_OPEN] = handle_markup_declaration_open_state,
-  [GUMBO_LEX_COMMENT_START] = handle_comment_start_state,
-  [GUMBO_LEX_COMMENT_START_DASH] = handle_comment_start_dash_state,
-  [GUMBO_LEX_COMMENT] = handle_comment_state,
-  [GUMBO_LEX_COMMENT_LT] = handle_comment_lt_state,
-  [GUMBO_LEX_COMMENT_LT_BANG] = handle_comment_lt_bang_state,
-  [GUMBO_LEX_COMMENT_LT_BANG_DASH] = handle_comment_lt_bang_dash_state,
-  [GUMBO_LEX_COMMENT_LT_BANG_DASH_DASH] = handle_comment_lt_bang_dash_dash_state,
-  [GUMBO_LEX_COMMENT_END_DASH] = handle_comment_end_dash_state,
-  [GUMBO_LEX_COMMENT_END] = handle_comment_end_state,
-  [GUMBO_LEX_COMMENT_END_BANG] = handle_comment_end_bang_state,
-  [GUMBO_LEX_DOCTYPE] = handle_doctype_state,
-  [GUMBO_LEX_BEFORE_DOCTYPE_NAME] = handle_before_doctype_name_state,
-  [GUMBO_LEX_DOCTYPE_NAME] = handle_doctype_name_state,
-  [GUMBO_LEX_AFTER_DOCTYPE_NAME] = handle_after_doctype_name_state,
-  [GUMBO_LEX_AFTER_DOCTYPE_PUBLIC_KEYWORD] = handle_after_doctype_public_keyword_state,
-  [GUMBO_LEX_BEFORE_DOCTYPE_PUBLIC_ID] = handle_before_doctype_public_id_state,
-  [GUMBO_LEX_DOCTYPE_PUBLIC_ID_DOUBLE_QUOTED] = handle_doctype_public_id_double_quoted_state,
-  [GUMBO_LEX_DOCTYPE_PUBLIC_ID_SINGLE_QUOTED] = handle_doctype_public_id_single_quoted_state,
-  [GUMBO_LEX_AFTER_DOCTYPE_PUBLIC_ID] = handle_after_doctype_public_id_state,
-  [GUMBO_LEX_BETWEEN_DOCTYPE_PUBLIC_SYSTEM_ID] = handle_between_doctype_public_system_id_state,
-  [GUMBO_LEX_AFTER_DOCTYPE_SYSTEM_KEYWORD] = handle_after_doctype_system_keyword_state,
-  [GUMBO_LEX_BEFORE_DOCTYPE_SYSTEM_ID] = handle_before_doctype_system_id_state,
-  [GUMBO_LEX_DOCTYPE_SYSTEM_ID_DOUBLE_QUOTED] = handle_doctype_system_id_double_quoted_state,
-  [GUMBO_LEX_DOCTYPE_SYSTEM_ID_SINGLE_QUOTED] = handle_doctype_system_id_single_quoted_state,
-  [GUMBO_LEX_AFTER_DOCTYPE_SYSTEM_ID] = handle_after_doctype_system_id_state,
-  [GUMBO_LEX_BOGUS_DOCTYPE] = handle_bogus_doctype_state,
-  [GUMBO_LEX_CDATA_SECTION] = handle_cdata_section_state,
-  [GUMBO_LEX_CDATA_SECTION_BRACKET] = handle_cdata_section_bracket_state,
-  [GUMBO_LEX_CDATA_SECTION_END] = handle_cdata_section_end_state,
-  [GUMBO_LEX_CHARACTER_REFERENCE] = handle_character_reference_state,
-  [GUMBO_LEX_NAMED_CHARACTER_REFERENCE] = handle_named_character_reference_state,
-  [GUMBO_LEX_AMBIGUOUS_AMPERSAND] = handle_ambiguous_ampersand_state,
-  [GUMBO_LEX_NUMERIC_CHARACTER_REFERENCE] = handle_numeric_character_reference_state,
-  [GUMBO_LEX_HEXADECIMAL_CHARACTER_REFERENCE_START] = handle_hexadecimal_character_reference_start_state,
-  [GUMBO_LEX_DECIMAL_CHARACTER_REFERENCE_START] = handle_decimal_character_reference_start_state,
-  [GUMBO_LEX_HEXADECIMAL_CHARACTER_REFERENCE] = handle_hexadecimal_character_reference_state,
-  [GUMBO_LEX_DECIMAL_CHARACTER_REFERENCE] = handle_decimal_character_reference_state,
-  [GUMBO_LEX_NUMERIC_CHARACTER_REFERENCE_END] = handle_numeric_character_reference_end_state,
+  GUMBO_LEXER_STATES(DISPATCH_ENTRY)
 };
+#undef DISPATCH_ENTRY
+#endif
 
 void gumbo_lex(GumboParser* parser, GumboToken* output) {
   // Because of the spec requirements that...
@@ -3404,6 +3749,46 @@ void gumbo_lex(GumboParser* parser, GumboToken* output) {
     return;
   }
 
+#ifdef GUMBO_COMPUTED_GOTO
+  // Each state's handler is called from its own label, which ends by jumping
+  // straight to the label of the next state. Every state thus has its own
+  // indirect branch for the predictor to learn, and the handlers, each called
+  // from just one place, can be inlined into the loop.
+#define STATE_LABEL(state, handler) [state] = &&lex_##handler,
+  static const void* const state_labels[] = {
+    GUMBO_LEXER_STATES(STATE_LABEL)
+  };
+#undef STATE_LABEL
+  int c;
+  StateResult result;
+  bool should_advance;
+
+#define DISPATCH() do { \
+    assert(!tokenizer->_resume_pos); \
+    assert(tokenizer->_buffered_emit_char == kGumboNoChar); \
+    c = utf8iterator_current(&tokenizer->_input); \
+    gumbo_debug( \
+      "Lexing character '%c' (%d) in state %u.\n", c, c, tokenizer->_state); \
+    goto *state_labels[tokenizer->_state]; \
+  } while (0)
+
+  // See the loop below for what happens after each handler.
+#define STATE_CASE(state, handler) \
+  lex_##handler: \
+    result = handler(parser, tokenizer, c, output); \
+    should_advance = !tokenizer->_reconsume_current_input; \
+    tokenizer->_reconsume_current_input = false; \
+    if (result == EMIT_TOKEN) \
+      return; \
+    if (should_advance) \
+      utf8iterator_next(&tokenizer->_input); \
+    DISPATCH();
+
+  DISPATCH();
+  GUMBO_LEXER_STATES(STATE_CASE)
+#undef STATE_CASE
+#undef DISPATCH
+#else
   while (1) {
     assert(!tokenizer->_resume_pos);
     assert(tokenizer->_buffered_emit_char == kGumboNoChar);
@@ -3423,6 +3808,7 @@ void gumbo_lex(GumboParser* parser, GumboToken* output) {
       utf8iterator_next(&tokenizer->_input);
     }
   }
+#endif
 }
 
 void gumbo_token_destroy(GumboToken* token) {
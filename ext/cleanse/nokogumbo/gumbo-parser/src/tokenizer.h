@@ -46,6 +46,16 @@ typedef struct GumboInternalTokenEndTag {
   char *name;
 } GumboTokenEndTag;
 
+// Struct containing a run of ordinary text: printable ASCII characters other
+// than '<' and '&', tabs, line feeds and form feeds. The run points straight
+// into the input buffer.
+typedef struct GumboInternalTokenCharacterRun {
+  const char* data;
+  size_t length;
+  // True if every character in the run is whitespace.
+  bool is_whitespace;
+} GumboTokenCharacterRun;
+
 // A data structure representing a single token in the input stream. This
 // contains an enum for the type, the source position, a GumboStringPiece
 // pointing to the original text, and then a union for any parsed data.
@@ -59,6 +69,7 @@ typedef struct GumboInternalToken {
     GumboTokenEndTag end_tag;
     const char* text;  // For comments.
     int character;     // For character, whitespace, null, and EOF tokens.
+    GumboTokenCharacterRun character_run;
   } v;
 } GumboToken;
 
@@ -92,6 +103,14 @@ void gumbo_tokenizer_set_is_adjusted_current_node_foreign (
   bool is_foreign
 );
 
+// Allows the tokenizer to emit GUMBO_TOKEN_CHARACTER_RUN tokens for the next
+// token, instead of one token per character. The parser only allows this in
+// the insertion modes that can consume a whole run in one step.
+void gumbo_tokenizer_set_allow_character_runs (
+  struct GumboInternalParser* parser,
+  bool allow
+);
+
 // Lexes a single token from the specified buffer, filling the output with the
 // parsed GumboToken data structure.
 void gumbo_lex(struct GumboInternalParser* parser, GumboToken* output);
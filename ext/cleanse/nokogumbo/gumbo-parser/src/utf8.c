@@ -27,6 +27,11 @@
 #include "ascii.h"
 #include "vector.h"
 
+#if (GNUC_AT_LEAST(4, 9) || defined(__clang__)) && defined(__SSE2__)
+# define UTF8_SSE2 1
+# include <emmintrin.h>
+#endif
+
 // References:
 // * https://tools.ietf.org/html/rfc3629
 // * https://html.spec.whatwg.org/multipage/parsing.html#preprocessing-the-input-stream
@@ -87,6 +92,52 @@ static inline uint32_t decode(uint32_t* state, uint32_t* codep, uint32_t byte) {
 
 // END COPIED CODE.
 
+// Returns a pointer to the first non-ASCII byte in [c, end), or end.
+static inline const char* skip_ascii(const char* c, const char* end) {
+#ifdef UTF8_SSE2
+  for (; end - c >= 64; c += 64) {
+    __m128i a = _mm_loadu_si128((const __m128i*) c);
+    __m128i b = _mm_loadu_si128((const __m128i*) (c + 16));
+    __m128i d = _mm_loadu_si128((const __m128i*) (c + 32));
+    __m128i e = _mm_loadu_si128((const __m128i*) (c + 48));
+    if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(d, e))))
+      break;
+  }
+  for (; end - c >= 16; c += 16) {
+    int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) c));
+    if (mask)
+      return c + __builtin_ctz(mask);
+  }
+#else
+  for (; end - c >= 8; c += 8) {
+    uint64_t word;
+    memcpy(&word, c, sizeof word);
+    if (word & UINT64_C(0x8080808080808080))
+      break;
+  }
+#endif
+  while (c < end && (unsigned char) *c < 0x80)
+    ++c;
+  return c;
+}
+
+// Returns true if [c, end) is well-formed UTF-8 (no invalid or truncated
+// sequences, overlong forms or surrogates). ASCII is skipped in bulk; only
+// the multi-byte sequences go through the DFA.
+static bool is_valid_utf8(const char* c, const char* end) {
+  while ((c = skip_ascii(c, end)) < end) {
+    uint32_t code_point = 0;
+    uint32_t state = UTF8_ACCEPT;
+    do {
+      if (decode(&state, &code_point, (uint32_t)(unsigned char) *c++) == UTF8_REJECT)
+        return false;
+    } while (state != UTF8_ACCEPT && c < end);
+    if (state != UTF8_ACCEPT)
+      return false;
+  }
+  return true;
+}
+
 // Adds a decoding error to the parser's error list, based on the current state
 // of the Utf8Iterator.
 static void add_error(Utf8Iterator* iter, GumboErrorType type) {
@@ -103,11 +154,107 @@ static void add_error(Utf8Iterator* iter, GumboErrorType type) {
   error->v.tokenizer.codepoint = iter->_current;
 }
 
+static inline const char* skip_stripped_bytes(const char* c, const char* end) {
+  while (c < end && utf8_is_stripped_byte((unsigned char) *c)) {
+    ++c;
+  }
+  return c;
+}
+
+// The stripping counterpart to read_char(). Since only ASCII survives, there
+// is nothing to decode: skip ahead to the next byte we keep and return it.
+static void read_stripped_char(Utf8Iterator* iter) {
+  const char* c = skip_stripped_bytes(iter->_start, iter->_end);
+  iter->_pos.offset += c - iter->_start;
+  iter->_start = c;
+
+  if (c >= iter->_end) {
+    iter->_current = -1;
+    iter->_width = 0;
+    return;
+  }
+
+  iter->_width = 1;
+  iter->_current = (unsigned char) *c;
+  if (iter->_current == '\r') {
+    // As in read_char(), but the \n may come after some skipped bytes.
+    const char* next = skip_stripped_bytes(c + 1, iter->_end);
+    if (next < iter->_end && *next == '\n') {
+      iter->_pos.offset += next - c;
+      iter->_start = next;
+    }
+    iter->_current = '\n';
+  }
+}
+
+// The counterpart to read_char() for input that is known to be valid UTF-8:
+// the lead byte gives the width, and only the code point checks are left.
+static void read_valid_char(Utf8Iterator* iter) {
+  if (iter->_start >= iter->_end) {
+    iter->_current = -1;
+    iter->_width = 0;
+    return;
+  }
+
+  const unsigned char* c = (const unsigned char*) iter->_start;
+  int code_point = c[0];
+  if (likely(code_point < 0x80)) {
+    iter->_width = 1;
+    if (code_point == '\r') {
+      // As in read_char().
+      if (iter->_start + 1 < iter->_end && c[1] == '\n') {
+        ++iter->_start;
+        ++iter->_pos.offset;
+      }
+      code_point = '\n';
+    }
+    iter->_current = code_point;
+    if (
+      unlikely(code_point < 0x20 || code_point == 0x7F)
+      && utf8_is_control(code_point)
+      && !(gumbo_ascii_isspace(code_point) || code_point == 0)
+    ) {
+      add_error(iter, GUMBO_ERR_CONTROL_CHARACTER_IN_INPUT_STREAM);
+    }
+    return;
+  }
+
+  if (code_point < 0xE0) {
+    iter->_width = 2;
+    code_point = ((code_point & 0x1F) << 6) | (c[1] & 0x3F);
+  } else if (code_point < 0xF0) {
+    iter->_width = 3;
+    code_point =
+      ((code_point & 0x0F) << 12) | ((c[1] & 0x3F) << 6) | (c[2] & 0x3F);
+  } else {
+    iter->_width = 4;
+    code_point =
+      ((code_point & 0x07) << 18) | ((c[1] & 0x3F) << 12)
+      | ((c[2] & 0x3F) << 6) | (c[3] & 0x3F);
+  }
+  iter->_current = code_point;
+  // Valid UTF-8 never encodes a surrogate.
+  if (utf8_is_noncharacter(code_point)) {
+    add_error(iter, GUMBO_ERR_NONCHARACTER_IN_INPUT_STREAM);
+  } else if (utf8_is_control(code_point)) {
+    add_error(iter, GUMBO_ERR_CONTROL_CHARACTER_IN_INPUT_STREAM);
+  }
+}
+
 // Reads the next UTF-8 character in the iter.
 // This assumes that iter->_start points to the beginning of the character.
 // When this method returns, iter->_width and iter->_current will be set
 // appropriately, as well as any error flags.
 static void read_char(Utf8Iterator* iter) {
+  if (iter->_strip) {
+    read_stripped_char(iter);
+    return;
+  }
+  if (iter->_valid) {
+    read_valid_char(iter);
+    return;
+  }
+
   if (iter->_start >= iter->_end) {
     // No input left to consume; emit an EOF and set width = 0.
     iter->_current = -1;
@@ -169,6 +316,9 @@ static void read_char(Utf8Iterator* iter) {
 
 static void update_position(Utf8Iterator* iter) {
   iter->_pos.offset += iter->_width;
+  if (!iter->_positions) {
+    return;
+  }
   if (iter->_current == '\n') {
     ++iter->_pos.line;
     iter->_pos.column = 1;
@@ -188,10 +338,14 @@ void utf8iterator_init (
 ) {
   iter->_start = source;
   iter->_end = source + source_length;
-  iter->_pos.line = 1;
-  iter->_pos.column = 1;
+  iter->_positions = !parser->_options->skip_source_positions;
+  iter->_pos.line = iter->_positions ? 1 : 0;
+  iter->_pos.column = iter->_positions ? 1 : 0;
   iter->_pos.offset = 0;
   iter->_parser = parser;
+  iter->_strip = parser->_options->strip_disallowed_bytes;
+  // Stripping leaves nothing but ASCII, so there is nothing to validate.
+  iter->_valid = !iter->_strip && is_valid_utf8(iter->_start, iter->_end);
   read_char(iter);
   if (iter->_current == kUtf8BomChar) {
     iter->_start += iter->_width;
@@ -208,12 +362,50 @@ void utf8iterator_next(Utf8Iterator* iter) {
   read_char(iter);
 }
 
+void utf8iterator_next_ascii(Utf8Iterator* iter, size_t count) {
+  if (count == 0) {
+    return;
+  }
+  if (iter->_positions) {
+    const char* c = iter->_start;
+    for (size_t i = 0; i < count; ++i) {
+      iter->_current = (unsigned char) c[i];
+      iter->_width = 1;
+      update_position(iter);
+    }
+  } else {
+    iter->_pos.offset += count;
+  }
+  iter->_start += count;
+  read_char(iter);
+}
+
 bool utf8iterator_maybe_consume_match (
   Utf8Iterator* iter,
   const char* prefix,
   size_t length,
   bool case_sensitive
 ) {
+  if (iter->_strip) {
+    // Compare byte by byte, ignoring whatever we would skip.
+    const char* c = iter->_start;
+    for (size_t i = 0; i < length; ++i, ++c) {
+      c = skip_stripped_bytes(c, iter->_end);
+      if (c >= iter->_end) {
+        return false;
+      }
+      if (case_sensitive
+          ? *c != prefix[i]
+          : gumbo_ascii_tolower(*c) != gumbo_ascii_tolower(prefix[i])) {
+        return false;
+      }
+    }
+    for (size_t i = 0; i < length; ++i) {
+      utf8iterator_next(iter);
+    }
+    return true;
+  }
+
   bool matched =
     (iter->_start + length <= iter->_end)
     && (
@@ -232,6 +424,18 @@ bool utf8iterator_maybe_consume_match (
   }
 }
 
+size_t utf8iterator_peek(const Utf8Iterator* iter, char* buffer, size_t size) {
+  const char* c = iter->_start;
+  size_t n = 0;
+  while (n < size && c < iter->_end) {
+    if (!iter->_strip || !utf8_is_stripped_byte((unsigned char) *c)) {
+      buffer[n++] = *c;
+    }
+    ++c;
+  }
+  return n;
+}
+
 void utf8iterator_mark(Utf8Iterator* iter) {
   iter->_mark = iter->_start;
   iter->_mark_pos = iter->_pos;
@@ -51,6 +51,18 @@ typedef struct GumboInternalUtf8Iterator {
   // The width in bytes of the current code point.
   size_t _width;
 
+  // Whether bytes outside printable ASCII and HTML whitespace are skipped
+  // (see GumboOptions.strip_disallowed_bytes).
+  bool _strip;
+
+  // Whether the whole input is known to be well-formed UTF-8, in which case
+  // characters are read without running the validating decoder.
+  bool _valid;
+
+  // Whether line and column numbers are kept up to date (see
+  // GumboOptions.skip_source_positions). The byte offset always is.
+  bool _positions;
+
   // The SourcePosition for the current location.
   GumboSourcePosition _pos;
 
@@ -80,6 +92,12 @@ CONST_FN static inline bool utf8_is_control(int c) {
   return ((unsigned int)c < 0x1Fu) || (c >= 0x7F && c <= 0x9F);
 }
 
+// Returns true if this byte is skipped when the iterator is stripping, i.e. it
+// isn't printable ASCII, a tab, a line feed, a form feed or a carriage return.
+CONST_FN static inline bool utf8_is_stripped_byte(unsigned char c) {
+  return !((c >= 0x20 && c < 0x7F) || c == '\t' || c == '\n' || c == '\f' || c == '\r');
+}
+
 // Initializes a new Utf8Iterator from the given byte buffer. The source does
 // not have to be NUL-terminated, but the length must be passed in explicitly.
 void utf8iterator_init (
@@ -92,6 +110,11 @@ void utf8iterator_init (
 // Advances the current position by one code point.
 void utf8iterator_next(Utf8Iterator* iter);
 
+// Advances past the next 'count' characters, starting with the current one,
+// all of which must be single bytes other than carriage returns. This is
+// equivalent to calling utf8iterator_next() 'count' times.
+void utf8iterator_next_ascii(Utf8Iterator* iter, size_t count);
+
 // Returns the current code point as an integer.
 static inline int utf8iterator_current(const Utf8Iterator* iter) {
   return iter->_current;
@@ -148,6 +171,10 @@ bool utf8iterator_maybe_consume_match (
   bool case_sensitive
 );
 
+// Copies up to 'size' bytes of the upcoming input into 'buffer', leaving out
+// any bytes the iterator would skip, and returns the number of bytes copied.
+size_t utf8iterator_peek(const Utf8Iterator* iter, char* buffer, size_t size);
+
 // "Marks" a particular location of interest in the input stream, so that it can
 // later be reset() to. There's also the ability to record an error at the
 // point that was marked, as oftentimes that's more useful than the last
@@ -19,9 +19,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include "util.h"
+#include "arena.h"
 #include "gumbo.h"
 
+// While an arena is entered on this thread (see arena.h), everything is
+// allocated from it. Pointers that didn't come from the arena, such as those
+// allocated before it was entered, are still handed to the system allocator.
+
 void* gumbo_alloc(size_t size) {
+  GumboArena* arena = gumbo_arena_current();
+  if (arena)
+    return gumbo_arena_alloc(arena, size);
   void* ptr = malloc(size);
   if (unlikely(ptr == NULL)) {
     perror(__func__);
@@ -31,6 +39,9 @@ void* gumbo_alloc(size_t size) {
 }
 
 void* gumbo_realloc(void* ptr, size_t size) {
+  GumboArena* arena = gumbo_arena_current();
+  if (arena && (!ptr || gumbo_arena_owns(arena, ptr)))
+    return gumbo_arena_realloc(arena, ptr, size);
   ptr = realloc(ptr, size);
   if (unlikely(ptr == NULL)) {
     perror(__func__);
@@ -40,6 +51,11 @@ void* gumbo_realloc(void* ptr, size_t size) {
 }
 
 void gumbo_free(void* ptr) {
+  GumboArena* arena = gumbo_arena_current();
+  if (arena && gumbo_arena_owns(arena, ptr)) {
+    gumbo_arena_free(arena, ptr);
+    return;
+  }
   free(ptr);
 }
 
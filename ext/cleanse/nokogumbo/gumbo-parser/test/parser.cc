@@ -204,6 +204,388 @@ TEST_F(GumboParserTest, TextOnly) {
   EXPECT_STREQ("Test", text->v.text.text);
 }
 
+TEST_F(GumboParserTest, TextRunsWithReferencesAndPre) {
+  Parse("<p>Fish &amp; chips\tfor two</p><pre>\nline one\nline two</pre>");
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(2, GetChildCount(body));
+
+  GumboNode* p = GetChild(body, 0);
+  ASSERT_EQ(1, GetChildCount(p));
+  GumboNode* text = GetChild(p, 0);
+  ASSERT_EQ(GUMBO_NODE_TEXT, text->type);
+  EXPECT_STREQ("Fish & chips\tfor two", text->v.text.text);
+  EXPECT_EQ(1, text->v.text.start_pos.line);
+  EXPECT_EQ(4, text->v.text.start_pos.column);
+  EXPECT_EQ(3, text->v.text.start_pos.offset);
+
+  GumboNode* pre = GetChild(body, 1);
+  ASSERT_EQ(1, GetChildCount(pre));
+  text = GetChild(pre, 0);
+  ASSERT_EQ(GUMBO_NODE_TEXT, text->type);
+  EXPECT_STREQ("line one\nline two", text->v.text.text);
+  EXPECT_EQ(2, text->v.text.start_pos.line);
+  EXPECT_EQ(1, text->v.text.start_pos.column);
+}
+
+// Serializes the tree under 'node' along with every source position and
+// original text, so two parses can be compared exactly.
+static void DumpTree(const GumboNode* node, std::string* out) {
+  char pos[64];
+  switch (node->type) {
+    case GUMBO_NODE_DOCUMENT:
+    case GUMBO_NODE_ELEMENT:
+    case GUMBO_NODE_TEMPLATE: {
+      const GumboVector* children;
+      if (node->type == GUMBO_NODE_DOCUMENT) {
+        children = &node->v.document.children;
+        out->append("#document");
+      } else {
+        const GumboElement* element = &node->v.element;
+        children = &element->children;
+        snprintf(pos, sizeof pos, "<%s@%zu:%zu", gumbo_normalized_tagname(element->tag),
+                 element->start_pos.line, element->start_pos.column);
+        out->append(pos);
+        out->append(element->original_tag.data, element->original_tag.length);
+        for (unsigned int i = 0; i < element->attributes.length; ++i) {
+          const GumboAttribute* attr =
+            static_cast<const GumboAttribute*>(element->attributes.data[i]);
+          snprintf(pos, sizeof pos, " @%zu:%zu:", attr->value_start.line,
+                   attr->value_start.column);
+          out->append(pos);
+          out->append(attr->name).append("=").append(attr->value);
+          out->append("|").append(attr->original_value.data, attr->original_value.length);
+        }
+      }
+      out->append(">\n");
+      for (unsigned int i = 0; i < children->length; ++i)
+        DumpTree(static_cast<const GumboNode*>(children->data[i]), out);
+      break;
+    }
+    default:
+      snprintf(pos, sizeof pos, "%d@%zu:%zu:%zu:", node->type,
+               node->v.text.start_pos.line, node->v.text.start_pos.column,
+               node->v.text.start_pos.offset);
+      out->append(pos).append(node->v.text.text).append("|");
+      out->append(node->v.text.original_text.data, node->v.text.original_text.length);
+      out->append("\n");
+      break;
+  }
+}
+
+TEST_F(GumboParserTest, StructuralIndexMatchesCharacterPath) {
+  const char* inputs[] = {
+    "",
+    "plain text",
+    "<p title=\"a 'quoted' value &amp; more\" alt='single \"quoted\"'>x</p>",
+    "<!-- a comment - with -- dashes and <tags> -->after",
+    "<!---->",
+    "text\r\nwith\rcarriage\r\n\r\nreturns<p a=\"x\r\ny\">",
+    "nul\x01\x7f bytes&notin; and \xc3\xa9\xe2\x82\xac non-ascii",
+    "<pre>\nfirst line</pre><textarea>\n&lt;b&gt;</textarea>",
+    "<script>if (a < b && c) { s = '<!--' }</script><style>p{x:'y'}</style>",
+    "<table><tr><td>cell text - with dash</td></tr></table>",
+    "<svg><title>in svg</title><desc>foreign - text</desc></svg>",
+    "<p>long paragraph of text that keeps going well past sixty-four bytes, "
+    "so that stop bytes show up on both sides of a block boundary &amp; "
+    "\"quotes\" don't stop the run</p><a href=\"https://example.com/a-very-"
+    "long/path/that/also/crosses/a/block/boundary?q=1&amp;r=2\">link</a>",
+  };
+  for (const char* input : inputs) {
+    for (bool strip : {false, true}) {
+      std::string expected, actual;
+      options_.strip_disallowed_bytes = strip;
+      options_.structural_index = false;
+      Parse(input);
+      DumpTree(root_, &expected);
+      options_.structural_index = true;
+      Parse(input);
+      DumpTree(root_, &actual);
+      EXPECT_EQ(expected, actual) << input;
+    }
+  }
+}
+
+TEST_F(GumboParserTest, ArenaMatchesSystemAllocator) {
+  std::string input =
+    "<!DOCTYPE html><title>t</title><p class=a id=b>Some &amp; text"
+    "<table><tr><td>cell<td>cell</table><svg><path d='M 0 0'/></svg>"
+    "<!-- comment --><b><i>misnested</b></i><pre>\n</pre>";
+  // Make sure the arena needs more than its first chunk.
+  for (int i = 0; i < 10; ++i)
+    input += input;
+
+  std::string expected, actual;
+  Parse(input);
+  EXPECT_EQ(NULL, output_->arena);
+  DumpTree(root_, &expected);
+  unsigned int errors = output_->errors.length;
+
+  options_.use_arena = true;
+  Parse(input);
+  EXPECT_TRUE(output_->arena != NULL);
+  DumpTree(root_, &actual);
+  EXPECT_EQ(expected, actual);
+  EXPECT_EQ(errors, output_->errors.length);
+}
+
+// Serializes the parts of a tree that GumboCompactTree keeps, from either
+// layout, in the same format.
+static void DumpStructure(const GumboNode* node, std::string* out) {
+  const GumboVector* children = NULL;
+  switch (node->type) {
+    case GUMBO_NODE_DOCUMENT:
+      out->append("#document\n");
+      children = &node->v.document.children;
+      break;
+    case GUMBO_NODE_ELEMENT:
+    case GUMBO_NODE_TEMPLATE: {
+      const GumboElement* element = &node->v.element;
+      out->append("<").append(gumbo_normalized_tagname(element->tag));
+      if (element->tag == GUMBO_TAG_UNKNOWN)
+        out->append(element->name);
+      out->append(1, '0' + element->tag_namespace);
+      for (unsigned int i = 0; i < element->attributes.length; ++i) {
+        const GumboAttribute* attr =
+          static_cast<const GumboAttribute*>(element->attributes.data[i]);
+        out->append(" ").append(attr->name).append("=").append(attr->value);
+      }
+      out->append(">\n");
+      children = &element->children;
+      break;
+    }
+    default:
+      out->append(1, '0' + node->type).append(node->v.text.text).append("\n");
+      break;
+  }
+  for (unsigned int i = 0; children && i < children->length; ++i)
+    DumpStructure(static_cast<const GumboNode*>(children->data[i]), out);
+  out->append("/\n");
+}
+
+static std::string CompactText(const GumboCompactTree* tree, GumboTextSpan span) {
+  return std::string(gumbo_compact_text(tree, span), span.length);
+}
+
+static void DumpStructure (
+  const GumboCompactTree* tree,
+  GumboNodeIndex index,
+  std::string* out
+) {
+  const GumboCompactNode* node = &tree->nodes[index];
+  switch (node->type) {
+    case GUMBO_NODE_DOCUMENT:
+      out->append("#document\n");
+      break;
+    case GUMBO_NODE_ELEMENT:
+    case GUMBO_NODE_TEMPLATE:
+      out->append("<").append(gumbo_normalized_tagname((GumboTag) node->tag));
+      if (node->tag == GUMBO_TAG_UNKNOWN)
+        out->append(CompactText(tree, node->text));
+      out->append(1, '0' + node->tag_namespace);
+      for (unsigned int i = 0; i < node->attribute_count; ++i) {
+        const GumboCompactAttribute* attr =
+          &tree->attributes[node->first_attribute + i];
+        out->append(" ").append(CompactText(tree, attr->name));
+        out->append("=").append(CompactText(tree, attr->value));
+      }
+      out->append(">\n");
+      break;
+    default:
+      out->append(1, '0' + node->type);
+      out->append(CompactText(tree, node->text)).append("\n");
+      break;
+  }
+  GumboNodeIndex last = GUMBO_COMPACT_NONE;
+  for (GumboNodeIndex child = node->first_child; child != GUMBO_COMPACT_NONE;
+       child = tree->nodes[child].next_sibling) {
+    EXPECT_EQ(index, tree->nodes[child].parent);
+    DumpStructure(tree, child, out);
+    last = child;
+  }
+  EXPECT_EQ(last, node->last_child);
+  out->append("/\n");
+}
+
+TEST_F(GumboParserTest, CompactTreeMatchesNodes) {
+  const char* input =
+    "<!DOCTYPE html PUBLIC \"-//W3C//DTD HTML 4.01//EN\" \"sys\">"
+    "<title>t &amp; t</title><p class=a id=b>Some &lt; text<custom-tag x>"
+    "</custom-tag><table><tr><td>cell<td>cell</table><svg viewBox='0 0 1 1'>"
+    "<path d='M 0 0'/></svg><template><li>in template</template>"
+    "<!-- comment --><b><i>misnested</b></i><pre>\n</pre> <math><mi>x";
+
+  std::string expected, actual;
+  Parse(input);
+  DumpStructure(root_, &expected);
+  unsigned int errors = output_->errors.length;
+
+  for (bool arena : {false, true}) {
+    options_.use_arena = arena;
+    options_.compact_tree = true;
+    Parse(input);
+    ASSERT_TRUE(output_->compact != NULL);
+    EXPECT_EQ(NULL, output_->document);
+    EXPECT_EQ(NULL, output_->arena);
+
+    const GumboCompactTree* tree = output_->compact;
+    EXPECT_EQ(0, tree->document);
+    ASSERT_NE(GUMBO_COMPACT_NONE, tree->root);
+    EXPECT_EQ(GUMBO_TAG_HTML, tree->nodes[tree->root].tag);
+    EXPECT_TRUE(tree->has_doctype);
+    EXPECT_STREQ("html", gumbo_compact_text(tree, tree->doctype_name));
+    EXPECT_STREQ("sys", gumbo_compact_text(tree, tree->system_identifier));
+    EXPECT_EQ(errors, output_->errors.length);
+
+    actual.clear();
+    DumpStructure(tree, tree->document, &actual);
+    EXPECT_EQ(expected, actual);
+  }
+}
+
+TEST_F(GumboParserTest, BorrowedText) {
+  const char* input =
+    "<p title=\"plain\" alt='a&amp;b' id=x>Some text &amp; more</p>"
+    "<b>caf\xC3\xA9 au lait</b><i>two\r\nlines</i><pre>\nfirst</pre>";
+
+  for (bool positions : {true, false}) {
+    options_.skip_source_positions = !positions;
+    Parse(input);
+    GumboNode* body = GetChild(GetChild(root_, 0), 1);
+
+    GumboNode* p = GetChild(body, 0);
+    GumboAttribute* title = GetAttribute(p, 0);
+    EXPECT_EQ(input + 10, title->borrowed_value.data);
+    EXPECT_EQ(5, title->borrowed_value.length);
+    EXPECT_EQ(NULL, GetAttribute(p, 1)->borrowed_value.data);
+    EXPECT_EQ(input + 34, GetAttribute(p, 2)->borrowed_value.data);
+
+    GumboText* text = &GetChild(p, 0)->v.text;
+    EXPECT_STREQ("Some text & more", text->text);
+    EXPECT_EQ(NULL, text->borrowed_text.data);
+
+    text = &GetChild(GetChild(body, 1), 0)->v.text;
+    EXPECT_EQ(std::string(text->text),
+              std::string(text->borrowed_text.data, text->borrowed_text.length));
+    EXPECT_EQ(NULL, GetChild(GetChild(body, 2), 0)->v.text.borrowed_text.data);
+
+    text = &GetChild(GetChild(body, 3), 0)->v.text;
+    EXPECT_STREQ("first", text->text);
+    EXPECT_EQ(5, text->borrowed_text.length);
+    EXPECT_EQ(0, strncmp("first", text->borrowed_text.data, 5));
+  }
+
+  options_.compact_tree = true;
+  Parse(input);
+  const GumboCompactTree* tree = output_->compact;
+  unsigned int borrowed = 0;
+  for (unsigned int i = 0; i < tree->attribute_count; ++i) {
+    if (tree->attributes[i].value.offset & GUMBO_COMPACT_INPUT_SPAN)
+      ++borrowed;
+  }
+  EXPECT_EQ(2, borrowed);
+  for (unsigned int i = 0; i < tree->node_count; ++i) {
+    GumboTextSpan span = tree->nodes[i].text;
+    if (span.offset & GUMBO_COMPACT_INPUT_SPAN) {
+      const char* text = gumbo_compact_text(tree, span);
+      EXPECT_GE(text, input);
+      EXPECT_LE(text + span.length, input + strlen(input));
+    }
+  }
+}
+
+TEST_F(GumboParserTest, StringLengths) {
+  Parse(
+    "<p data-x=\"a&amp;b\" hidden>One &lt; two<!-- note -->"
+    "<svg viewbox='0 0 1 1' xlink:href=y></svg>"
+  );
+  GumboNode* body = GetChild(GetChild(root_, 0), 1);
+  GumboNode* p = GetChild(body, 0);
+
+  GumboAttribute* attr = GetAttribute(p, 0);
+  EXPECT_EQ(strlen(attr->name), attr->name_length);
+  EXPECT_EQ(3, attr->value_length);
+  attr = GetAttribute(p, 1);
+  EXPECT_EQ(6, attr->name_length);
+  EXPECT_EQ(0, attr->value_length);
+
+  EXPECT_EQ(strlen("One < two"), GetChild(p, 0)->v.text.length);
+  EXPECT_EQ(strlen(" note "), GetChild(p, 1)->v.text.length);
+
+  // Renamed foreign attributes keep their lengths up to date.
+  GumboNode* svg = GetChild(p, 2);
+  for (unsigned int i = 0; i < svg->v.element.attributes.length; ++i) {
+    attr = GetAttribute(svg, i);
+    EXPECT_EQ(strlen(attr->name), attr->name_length);
+    EXPECT_EQ(strlen(attr->value), attr->value_length);
+  }
+  EXPECT_STREQ("viewBox", GetAttribute(svg, 0)->name);
+}
+
+TEST_F(GumboParserTest, SkipSourcePositions) {
+  const char* input =
+    "<!DOCTYPE html>\n<p class=a\tid='b'>Some\r\n&amp; text</p>\n"
+    "<pre>\nline</pre><!-- comment --><table><tr><td>x</table>\t<b>y";
+
+  std::string expected, actual;
+  Parse(input);
+  DumpStructure(root_, &expected);
+  unsigned int errors = output_->errors.length;
+
+  options_.skip_source_positions = true;
+  Parse(input);
+  DumpStructure(root_, &actual);
+  EXPECT_EQ(expected, actual);
+  ASSERT_EQ(errors, output_->errors.length);
+
+  GumboNode* body = GetChild(GetChild(root_, 0), 1);
+  GumboNode* p = GetChild(body, 0);
+  ASSERT_EQ(GUMBO_TAG_P, p->v.element.tag);
+  EXPECT_EQ(0, p->v.element.start_pos.line);
+  EXPECT_EQ(0, p->v.element.start_pos.column);
+  EXPECT_EQ(16, p->v.element.start_pos.offset);
+  EXPECT_EQ(0, p->v.element.original_tag.length);
+  EXPECT_EQ(0, p->v.element.original_end_tag.length);
+
+  GumboAttribute* id = GetAttribute(p, 1);
+  EXPECT_STREQ("b", id->value);
+  EXPECT_EQ(0, id->original_value.length);
+
+  GumboNode* text = GetChild(p, 0);
+  EXPECT_STREQ("Some\n& text", text->v.text.text);
+  EXPECT_EQ(0, text->v.text.original_text.length);
+  EXPECT_EQ(34, text->v.text.start_pos.offset);
+
+  for (unsigned int i = 0; i < errors; ++i) {
+    GumboSourcePosition position =
+      gumbo_error_position(static_cast<GumboError*>(output_->errors.data[i]));
+    EXPECT_EQ(0, position.line);
+    EXPECT_EQ(0, position.column);
+  }
+}
+
+TEST_F(GumboParserTest, ErrorCollectionCanBeTurnedOff) {
+  const char* input = "<div/><p a=1 a=2>&nosuch;\x01</b><table>x";
+
+  options_.max_errors = -1;
+  Parse(input);
+  EXPECT_TRUE(output_->document_error);
+  EXPECT_LT(2, output_->errors.length);
+
+  options_.max_errors = 2;
+  Parse(input);
+  EXPECT_TRUE(output_->document_error);
+  EXPECT_EQ(2, output_->errors.length);
+
+  options_.max_errors = 0;
+  Parse(input);
+  EXPECT_TRUE(output_->document_error);
+  EXPECT_EQ(0, output_->errors.length);
+
+  Parse("<!DOCTYPE html><title>fine</title>");
+  EXPECT_FALSE(output_->document_error);
+}
+
 TEST_F(GumboParserTest, SelfClosingTagError) {
   Parse("<div/>");
   // No DOCTYPE
@@ -402,6 +784,36 @@ TEST_F(GumboParserTest, DuplicateAttributes) {
   // TODO(jdtang): Run some assertions on the parse error that's added.
 }
 
+TEST_F(GumboParserTest, ManyDuplicateAttributes) {
+  // Enough attributes to use the hashed duplicate check, on tags of
+  // decreasing size so that its table is both reused and released.
+  std::string text;
+  const int sizes[] = {300, 40, 20, 17};
+  for (int size : sizes) {
+    text += "<div";
+    for (int pass = 0; pass < 2; ++pass) {
+      for (int i = 0; i < size; ++i) {
+        text += " data-" + std::to_string(i) + "=" + (pass ? "dup" : "v");
+      }
+    }
+    text += "></div>";
+  }
+  Parse(text);
+
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(4, GetChildCount(body));
+  for (int n = 0; n < 4; ++n) {
+    GumboNode* div = GetChild(body, n);
+    ASSERT_EQ(sizes[n], GetAttributeCount(div));
+    for (int i = 0; i < sizes[n]; ++i) {
+      GumboAttribute* attr = GetAttribute(div, i);
+      EXPECT_EQ("data-" + std::to_string(i), attr->name);
+      EXPECT_STREQ("v", attr->value);
+    }
+  }
+}
+
 TEST_F(GumboParserTest, LinkTagsInHead) {
   Parse(
       "<html>\n"
@@ -98,4 +98,20 @@ TEST_F(GumboStringBufferTest, ToString) {
   gumbo_free(dest);
 }
 
+TEST_F(GumboStringBufferTest, Release) {
+  INIT_GUMBO_STRING(str, "01234567");
+  gumbo_string_buffer_append_string(&str, &buffer_);
+
+  char* dest = gumbo_string_buffer_release(&buffer_);
+  EXPECT_STREQ("01234567", dest);
+  EXPECT_EQ(0, buffer_.length);
+  EXPECT_NE(dest, buffer_.data);
+
+  gumbo_string_buffer_append_string(&str, &buffer_);
+  NullTerminateBuffer();
+  EXPECT_STREQ("01234567", buffer_.data);
+  EXPECT_STREQ("01234567", dest);
+  gumbo_free(dest);
+}
+
 }  // namespace
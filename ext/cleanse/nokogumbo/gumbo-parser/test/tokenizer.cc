@@ -632,6 +632,24 @@ TEST_F(GumboTokenizerTest, Whitespace) {
   AtEnd();
 }
 
+TEST_F(GumboTokenizerTest, CommonNamedCharRefs) {
+  SetInput("&lt;&gt;&amp;&quot;&apos;&ampx&notin;&l&lt");
+  NextChar('<');
+  NextChar('>');
+  NextChar('&');
+  NextChar('"');
+  NextChar('\'');
+  NextChar('&', true);
+  Error(GUMBO_ERR_MISSING_SEMICOLON_AFTER_CHARACTER_REFERENCE);
+  NextChar('x');
+  NextChar(0x2209);
+  NextChar('&');
+  NextChar('l');
+  NextChar('<', true);
+  Error(GUMBO_ERR_MISSING_SEMICOLON_AFTER_CHARACTER_REFERENCE);
+  AtEnd();
+}
+
 TEST_F(GumboTokenizerTest, NumericHex) {
   SetInput("&#x12ab;");
   NextChar(0x12ab);
@@ -1991,7 +2009,7 @@ TEST_F(GumboTokenizerTest, ScriptData_LT_Bang_Dash_Dash_LT_Alpha_ScriptGT_Dash_D
 }
 
 TEST_F(GumboTokenizerTest, ScriptData_LT_Bang_Dash_Dash_LT_Alpha_ScriptTab_Dash_NULL) {
-  SetInput("<!--<scRIpt\t-\x00", sizeof("<!--<scRIpt\t---\x00")-1);
+  SetInput("<!--<scRIpt\t-\x00", sizeof("<!--<scRIpt\t-\x00")-1);
   SetState(GUMBO_LEX_SCRIPT_DATA);
   NextChar('<');
   NextChar('!');
@@ -17,6 +17,7 @@
 #include "utf8.h"
 
 #include <string.h>
+#include <string>
 
 #include "gtest/gtest.h"
 #include "error.h"
@@ -377,6 +378,54 @@ TEST_F(Utf8Test, TruncatedInput) {
   EXPECT_EQ(-1, utf8iterator_current(&input_));
 }
 
+TEST_F(Utf8Test, ValidInputChecks) {
+  // A C1 control and a noncharacter are well-formed UTF-8, so they go through
+  // the fast path, but are still parse errors.
+  ResetText("a\xC2\x85\xEF\xB7\x90\xF0\x9F\x98\x80\x7F");
+
+  EXPECT_EQ('a', utf8iterator_current(&input_));
+  utf8iterator_next(&input_);
+  EXPECT_EQ(0x85, utf8iterator_current(&input_));
+  EXPECT_EQ(1, GetNumErrors());
+  EXPECT_EQ(GUMBO_ERR_CONTROL_CHARACTER_IN_INPUT_STREAM, GetFirstError()->type);
+  utf8iterator_next(&input_);
+  EXPECT_EQ(0xFDD0, utf8iterator_current(&input_));
+  EXPECT_EQ(2, GetNumErrors());
+  utf8iterator_next(&input_);
+  EXPECT_EQ(0x1F600, utf8iterator_current(&input_));
+  EXPECT_EQ(2, GetNumErrors());
+  utf8iterator_next(&input_);
+  EXPECT_EQ(0x7F, utf8iterator_current(&input_));
+  EXPECT_EQ(3, GetNumErrors());
+
+  GumboSourcePosition pos;
+  utf8iterator_get_position(&input_, &pos);
+  EXPECT_EQ(5, pos.column);
+  EXPECT_EQ(10, pos.offset);
+
+  utf8iterator_next(&input_);
+  EXPECT_EQ(-1, utf8iterator_current(&input_));
+  errors_are_expected_ = true;
+}
+
+TEST_F(Utf8Test, InvalidByteAfterLongAsciiRun) {
+  // The invalid byte is well past the bulk ASCII scan, and has to be found.
+  std::string text(100, 'x');
+  text += "\xC3\xA9\xFF";
+  text_ = text.c_str();
+  utf8iterator_init(&parser_, text_, text.length(), &input_);
+
+  Advance(100);
+  EXPECT_EQ(0, GetNumErrors());
+  EXPECT_EQ(0xE9, utf8iterator_current(&input_));
+  utf8iterator_next(&input_);
+  EXPECT_EQ(0xFFFD, utf8iterator_current(&input_));
+  EXPECT_EQ(1, GetNumErrors());
+  EXPECT_EQ(GUMBO_ERR_UTF8_INVALID, GetFirstError()->type);
+  EXPECT_EQ(102, GetFirstError()->position.offset);
+  errors_are_expected_ = true;
+}
+
 TEST_F(Utf8Test, Html5SpecExample) {
   // This example has since been removed from the spec, and the spec has been
   // changed to reference the Unicode Standard 6.2, 5.22 "Best practices for
@@ -620,4 +669,48 @@ TEST_F(Utf8Test, MarkReset) {
   EXPECT_EQ(5, position.offset);
 }
 
+TEST_F(Utf8Test, StripDisallowedBytes) {
+  options_.strip_disallowed_bytes = true;
+  ResetText("\x01" "a\xC3\xA9\x7F" "b\r\x0B\nc\xEF\xBF\xBE");
+
+  EXPECT_EQ(0, GetNumErrors());
+  EXPECT_EQ('a', utf8iterator_current(&input_));
+  EXPECT_EQ(text_ + 1, utf8iterator_get_char_pointer(&input_));
+
+  utf8iterator_next(&input_);
+  EXPECT_EQ('b', utf8iterator_current(&input_));
+  EXPECT_EQ(text_ + 5, utf8iterator_get_char_pointer(&input_));
+
+  // The CR/LF pair is still folded with a skipped byte in between.
+  utf8iterator_next(&input_);
+  EXPECT_EQ('\n', utf8iterator_current(&input_));
+  EXPECT_EQ(text_ + 8, utf8iterator_get_char_pointer(&input_));
+
+  utf8iterator_next(&input_);
+  EXPECT_EQ('c', utf8iterator_current(&input_));
+
+  GumboSourcePosition pos;
+  utf8iterator_get_position(&input_, &pos);
+  EXPECT_EQ(2, pos.line);
+  EXPECT_EQ(1, pos.column);
+  EXPECT_EQ(9, pos.offset);
+
+  utf8iterator_next(&input_);
+  EXPECT_EQ(-1, utf8iterator_current(&input_));
+  EXPECT_EQ(0, GetNumErrors());
+}
+
+TEST_F(Utf8Test, StripDisallowedBytesMatch) {
+  options_.strip_disallowed_bytes = true;
+  ResetText("DOC\x01type\xC2\xA0 html");
+
+  char window[8];
+  EXPECT_EQ(8u, utf8iterator_peek(&input_, window, sizeof(window)));
+  EXPECT_EQ(0, memcmp(window, "DOCtype ", 8));
+
+  EXPECT_FALSE(utf8iterator_maybe_consume_match(&input_, "DOCTYPE", 7, true));
+  EXPECT_TRUE(utf8iterator_maybe_consume_match(&input_, "doctype", 7, false));
+  EXPECT_EQ(' ', utf8iterator_current(&input_));
+}
+
 }  // namespace
@@ -1,4 +1,6 @@
 #include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 #include "strbuf.h"
 
@@ -9,11 +11,11 @@
 #include "util.h"
 
 /*
- * Default memory management helpers;
- * set to system's realloc and free by default
+ * Default memory management helpers: the system's realloc and free.
+ * These are const so that every thread and Ractor sees the same pair.
  */
-void *(* gumbo_user_allocator)(void *, size_t) = realloc;
-void (* gumbo_user_free)(void *) = free;
+void *(*const gumbo_user_allocator)(void *, size_t) = realloc;
+void (*const gumbo_user_free)(void *) = free;
 
 void* gumbo_re_realloc(void* ptr, size_t size)
 {
@@ -99,28 +101,6 @@ void strbuf_free(GumboStringBuffer* buffer)
   gumbo_free(buffer->data);
 }
 
-void gumbo_element_set_attribute(
-  GumboElement *element, const char *name, const char *value)
-{
-  GumboVector *attributes = &element->attributes;
-  GumboAttribute *attr = gumbo_get_attribute(attributes, name);
-
-  if (!attr) {
-    attr = gumbo_malloc(sizeof(GumboAttribute));
-    attr->value = NULL;
-    attr->attr_namespace = GUMBO_ATTR_NAMESPACE_NONE;
-
-    attr->name = strdup(name);
-    attr->original_name = kGumboEmptyString;
-    attr->name_start = kGumboEmptySourcePosition;
-    attr->name_end = kGumboEmptySourcePosition;
-
-    gumbo_vector_add(attr, attributes);
-  }
-
-  gumbo_attribute_set_value(attr, value);
-}
-
 char* strdup(const char* str)
 {
   const size_t size = strlen(str) + 1;
@@ -131,21 +111,6 @@ char* strdup(const char* str)
   return memcpy(buffer, str, size);
 }
 
-void gumbo_element_remove_attribute_at(GumboElement *element, unsigned int pos)
-{
-  GumboAttribute *attr = element->attributes.data[pos];
-  gumbo_vector_remove_at(pos, &element->attributes);
-  gumbo_destroy_attribute(attr);
-}
-
-void gumbo_element_remove_attribute(GumboElement *element, const char *name)
-{
-  int idx = gumbo_get_attribute(&element->attributes, name);
-  if (idx >= 0) {
-    gumbo_element_remove_attribute_at(element, idx);
-  }
-}
-
 // TODO
 void* gumbo_realloc(void* ptr, size_t size) RETURNS_NONNULL;
 static void enlarge_vector_if_full(GumboVector* vector, unsigned int space)
@@ -201,16 +166,6 @@ void gumbo_string_buffer_put(GumboStringBuffer *buffer,
   buffer->length += length;
 }
 
-
-void gumbo_attribute_set_value(GumboAttribute *attr, const char *value)
-{
-  gumbo_free((void *)attr->value);
-  attr->value = strdup(value);
-  attr->original_value = kGumboEmptyString;
-  attr->value_start = kGumboEmptySourcePosition;
-  attr->value_end = kGumboEmptySourcePosition;
-}
-
 void strbuf_putv(GumboStringBuffer *buffer, int count, ...)
 {
   va_list ap;
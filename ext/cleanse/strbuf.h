@@ -19,8 +19,8 @@
 
 char *gumbo_strdup(const char *str) XMALLOC NONNULL_ARGS;
 
-extern void *(*gumbo_user_allocator)(void *, size_t);
-extern void (*gumbo_user_free)(void *);
+extern void *(*const gumbo_user_allocator)(void *, size_t);
+extern void (*const gumbo_user_free)(void *);
 
 static inline int gumbo_tolower(int c)
 {
@@ -43,20 +43,11 @@ void strbuf_splice(int where, int n_to_remove,
 
 void strbuf_free(GumboStringBuffer *buffer);
 
-void gumbo_element_set_attribute(
-  GumboElement *element, const char *name, const char *value);
-
-void gumbo_element_remove_attribute_at(GumboElement *element, unsigned int pos);
-
-void gumbo_element_remove_attribute(GumboElement *element, const char *name);
-
 void gumbo_vector_splice(
   int where, int n_to_remove, void **data, int n_to_insert, GumboVector *vector);
 
 char *strdup(const char *str);
 
-void gumbo_attribute_set_value(GumboAttribute *attr, const char *value);
-
 void strbuf_putv(GumboStringBuffer *buffer, int count, ...);
 
 void strbuf_putc(GumboStringBuffer *buffer, int c);
@@ -3,14 +3,15 @@
 
 #define FNV_SEED ((uint32_t)0x811c9dc5)
 
-static uint32_t fnv_32a_str(char *str, uint32_t hval)
+static uint32_t fnv_32a_buf(const char *buf, size_t len, uint32_t hval)
 {
-  unsigned char *s = (unsigned char *)str;	/* unsigned string */
+  const unsigned char *s = (const unsigned char *)buf;	/* unsigned buffer */
+  const unsigned char *end = s + len;
 
   /*
    * FNV-1a hash each octet in the buffer
    */
-  while (*s) {
+  while (s < end) {
 
     /* xor the bottom with the current octet */
     hval ^= (uint32_t)*s++;
@@ -25,42 +26,45 @@ static uint32_t fnv_32a_str(char *str, uint32_t hval)
 
 void string_set_new(string_set_t *set)
 {
-  short initial_size = 1;
   set->size = 0;
   set->allocated = 1;
-  set->strings = (char **) calloc(1, sizeof(char *));
+  set->strings = xcalloc(1, sizeof(char *));
 }
 
 void string_set_free(string_set_t *set)
 {
-  for (size_t i = 0; i < set->size; i++) {
-    free(set->strings[i]);
+  for (size_t i = 0; i < set->allocated; i++) {
+    xfree(set->strings[i]);
   }
-  free(set->strings);
+  xfree(set->strings);
 }
 
-static void string_set_resize(string_set_t *set)
+static void string_set_insert(string_set_t *set, char *str)
 {
-  uint32_t i, new_size = set->allocated ? (set->allocated * 2) : 4;
-  char **new_strings = xcalloc(new_size, sizeof(char *));
+  uint32_t hash = fnv_32a_buf(str, strlen(str), FNV_SEED);
 
-  for (i = 0; i < set->allocated; ++i) {
-    char *str = set->strings[i];
+  while (set->strings[hash & (set->allocated - 1)] != NULL) {
+    hash++;
+  }
 
-    if (str) {
-      uint32_t hash = fnv_32a_str(str, FNV_SEED);
+  set->strings[hash & (set->allocated - 1)] = str;
+}
 
-      while (new_strings[hash & (new_size - 1)] != NULL) {
-        hash++;
-      }
+static void string_set_resize(string_set_t *set)
+{
+  uint32_t i, old_size = set->allocated;
+  char **old_strings = set->strings;
+
+  set->allocated = old_size ? (old_size * 2) : 4;
+  set->strings = xcalloc(set->allocated, sizeof(char *));
 
-      new_strings[hash & (new_size - 1)] = str;
+  for (i = 0; i < old_size; ++i) {
+    if (old_strings[i]) {
+      string_set_insert(set, old_strings[i]);
     }
   }
 
-  xfree(set->strings);
-  set->strings = new_strings;
-  set->allocated = new_size;
+  xfree(old_strings);
 }
 
 void string_set_add(string_set_t *set, const char *str)
@@ -69,38 +73,35 @@ void string_set_add(string_set_t *set, const char *str)
     return;
   }
 
-  uint32_t hash = fnv_32a_str(str, FNV_SEED);
-  const char *m;
-
   if (set->size + 1 > set->allocated * 3 / 4) {
     string_set_resize(set);
   }
 
-  while ((m = set->strings[hash & (set->allocated - 1)]) != NULL) {
-    if (!strcmp(m, str)) {
-      return;
-    }
-    hash++;
-  }
-
-  set->strings[hash & (set->allocated - 1)] = strdup(str);
+  string_set_insert(set, ruby_strdup(str));
   set->size++;
 }
 
 void string_set_remove(string_set_t *set, const char *str)
 {
-  uint32_t hash = fnv_32a_str(str, FNV_SEED);
+  uint32_t hash = fnv_32a_buf(str, strlen(str), FNV_SEED);
+  uint32_t mask = set->allocated - 1;
   char *m;
 
-  if (!set->allocated) {
+  if (!set->size) {
     return;
   }
 
-  while ((m = set->strings[hash & (set->allocated - 1)]) != NULL) {
+  while ((m = set->strings[hash & mask]) != NULL) {
     if (!strcmp(m, str)) {
       xfree(m);
-      set->strings[hash & (set->allocated - 1)] = NULL;
+      set->strings[hash & mask] = NULL;
       set->size--;
+
+      // Put back the rest of the run, which may have probed past this slot
+      while ((m = set->strings[++hash & mask]) != NULL) {
+        set->strings[hash & mask] = NULL;
+        string_set_insert(set, m);
+      }
       return;
     }
 
@@ -110,15 +111,25 @@ void string_set_remove(string_set_t *set, const char *str)
 
 bool string_set_contains(const string_set_t *set, const char *str)
 {
-  uint32_t hash = fnv_32a_str(str, FNV_SEED);
+  return set->size && string_set_contains_n(set, str, strlen(str));
+}
+
+/*
+ * Looks up the `len` bytes at `str`, which need not be NUL-terminated
+ * but must not contain a NUL byte themselves.
+ */
+bool string_set_contains_n(const string_set_t *set, const char *str, size_t len)
+{
+  uint32_t hash;
   const char *m;
 
-  if (!set->allocated) {
+  if (!set->size) {
     return false;
   }
 
+  hash = fnv_32a_buf(str, len, FNV_SEED);
   while ((m = set->strings[hash & (set->allocated - 1)]) != NULL) {
-    if (m[0] == str[0] && !strcmp(m + 1, str + 1)) {
+    if (!strncmp(m, str, len) && m[len] == '\0') {
       return true;
     }
 
@@ -127,3 +138,294 @@ bool string_set_contains(const string_set_t *set, const char *str)
 
   return false;
 }
+
+static inline uint32_t
+string_index_hash(const string_index_t *index, const char *str, size_t len)
+{
+  const unsigned char *s = (const unsigned char *)str;
+  uint32_t hash;
+
+  if (!index->sampled) {
+    return fnv_32a_buf(str, len, index->seed);
+  }
+
+  hash = index->seed ^ (uint32_t)len;
+  if (len) {
+    hash ^= (uint32_t)s[0] << 8 | (uint32_t)s[len / 2] << 16 |
+            (uint32_t)s[len - 1] << 24;
+  }
+  hash *= 0x9e3779b1;
+  return hash ^ (hash >> 16);
+}
+
+/*
+ * Spreads a string's hash over 64 bits. The low bits pick its bucket and
+ * two higher, non-overlapping ranges give the base and step that
+ * string_index_slot displaces it by.
+ */
+static inline uint64_t
+string_index_mix(uint32_t hash)
+{
+  uint64_t x = hash * 0x9e3779b97f4a7c15ULL;
+  x ^= x >> 32;
+  x *= 0xd6e8feb86659fd93ULL;
+  return x ^ (x >> 32);
+}
+
+/*
+ * A bucket's displacement packs two numbers: its bits from `shift` up are
+ * a multiplier for the string's step, and the bits below are an offset.
+ */
+static inline uint32_t
+string_index_slot(const string_index_t *index, uint64_t mixed, uint32_t disp)
+{
+  uint32_t base = (uint32_t)(mixed >> 32);
+  uint32_t step = (uint32_t)(mixed >> 16) | 1;
+  return (base + (disp >> index->shift) * step + disp) & index->mask;
+}
+
+/*
+ * Each string is stored in the blob as a record: its length as a 32-bit
+ * word, then its bytes, padded so that the next record is aligned too.
+ */
+static inline uint32_t
+string_index_record_length(const string_index_t *index, uint32_t id)
+{
+  return *(const uint32_t *)(index->blob + index->offsets[id - 1]);
+}
+
+static inline const char *
+string_index_record_data(const string_index_t *index, uint32_t id)
+{
+  return index->blob + index->offsets[id - 1] + sizeof(uint32_t);
+}
+
+static inline bool
+string_index_matches(const string_index_t *index, uint32_t id,
+                     const char *str, size_t len)
+{
+  return string_index_record_length(index, id) == len &&
+         !memcmp(string_index_record_data(index, id), str, len);
+}
+
+// How many step multipliers to try for a bucket before giving up on a seed
+#define STRING_INDEX_MAX_STEPS 32
+
+/*
+ * Finds a displacement that puts every string of bucket `b` (the `k` IDs
+ * at `ids`) into an empty slot, and claims those slots.
+ */
+static bool
+string_index_place_bucket(string_index_t *index, const uint64_t *mixed,
+                          const uint32_t *ids, uint32_t k, uint32_t b)
+{
+  uint32_t steps, offset, i;
+
+  for (steps = 0; steps < STRING_INDEX_MAX_STEPS; ++steps) {
+    for (offset = 0; offset <= index->mask; ++offset) {
+      uint32_t disp = steps << index->shift | offset;
+
+      for (i = 0; i < k; ++i) {
+        uint32_t *slot = &index->slots[
+          string_index_slot(index, mixed[ids[i] - 1], disp)];
+        if (*slot) {
+          break;
+        }
+        *slot = ids[i];
+      }
+
+      if (i == k) {
+        index->displacements[b] = disp;
+        return true;
+      }
+
+      while (i--) {
+        index->slots[string_index_slot(index, mixed[ids[i] - 1], disp)] = 0;
+      }
+    }
+  }
+  return false;
+}
+
+/*
+ * Hashes every string with the current seed into its bucket, then places
+ * the buckets largest first, while the table is still mostly empty.
+ * Returns false if two strings hash identically or a bucket can't be
+ * placed, in which case the caller tries another seed.
+ */
+static bool
+string_index_fill(string_index_t *index, uint64_t *mixed, uint32_t *ids,
+                  uint32_t *starts, uint32_t *order)
+{
+  uint32_t buckets = index->bucket_mask + 1;
+  uint32_t id, b, i, j, largest = 0, *by_size;
+  bool placed = true;
+
+  memset(starts, 0, (buckets + 1) * sizeof(uint32_t));
+  for (id = 1; id <= index->count; ++id) {
+    mixed[id - 1] = string_index_mix(string_index_hash(index,
+      string_index_record_data(index, id), string_index_record_length(index, id)));
+    starts[(mixed[id - 1] & index->bucket_mask) + 1]++;
+  }
+
+  for (b = 0; b < buckets; ++b) {
+    if (starts[b + 1] > largest) {
+      largest = starts[b + 1];
+    }
+    starts[b + 1] += starts[b];
+  }
+
+  // Group the IDs by bucket, using `order` as each bucket's fill cursor
+  memcpy(order, starts, buckets * sizeof(uint32_t));
+  for (id = 1; id <= index->count; ++id) {
+    ids[order[mixed[id - 1] & index->bucket_mask]++] = id;
+  }
+
+  // Strings that hash the same share a bucket and can never be separated
+  for (b = 0; b < buckets; ++b) {
+    for (i = starts[b]; i < starts[b + 1]; ++i) {
+      for (j = i + 1; j < starts[b + 1]; ++j) {
+        if (mixed[ids[i] - 1] == mixed[ids[j] - 1]) {
+          return false;
+        }
+      }
+    }
+  }
+
+  // Sort the buckets by size, largest first, by counting
+  by_size = xcalloc(largest + 2, sizeof(uint32_t));
+  for (b = 0; b < buckets; ++b) {
+    by_size[largest - (starts[b + 1] - starts[b]) + 1]++;
+  }
+  for (i = 0; i <= largest; ++i) {
+    by_size[i + 1] += by_size[i];
+  }
+  for (b = 0; b < buckets; ++b) {
+    order[by_size[largest - (starts[b + 1] - starts[b])]++] = b;
+  }
+  xfree(by_size);
+
+  memset(index->slots, 0, (index->mask + 1) * sizeof(uint32_t));
+  memset(index->displacements, 0, buckets * sizeof(uint32_t));
+  for (i = 0; i < buckets && placed; ++i) {
+    b = order[i];
+    placed = starts[b] == starts[b + 1] ||
+             string_index_place_bucket(index, mixed, ids + starts[b],
+                                       starts[b + 1] - starts[b], b);
+  }
+  return placed;
+}
+
+#define RECORD_SIZE(len) \
+  ((sizeof(uint32_t) + (len) + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1))
+
+void string_index_build(string_index_t *index, const char *const *strings,
+                        uint32_t count)
+{
+  uint32_t i, size = 1, buckets = 1, blob_len = 0;
+  uint32_t *ids, *starts, *order;
+  uint64_t *mixed;
+
+  memset(index, 0, sizeof(*index));
+  index->count = count;
+  if (!count) {
+    return;
+  }
+
+  index->offsets = xmalloc(count * sizeof(uint32_t));
+  for (i = 0; i < count; ++i) {
+    index->offsets[i] = blob_len;
+    blob_len += RECORD_SIZE(strlen(strings[i]));
+  }
+
+  index->blob = xcalloc(blob_len, 1);
+  for (i = 0; i < count; ++i) {
+    uint32_t len = (uint32_t)strlen(strings[i]);
+    memcpy(index->blob + index->offsets[i], &len, sizeof(len));
+    memcpy(index->blob + index->offsets[i] + sizeof(len), strings[i], len);
+  }
+
+  // A single string is compared directly, without hashing
+  if (count == 1) {
+    return;
+  }
+
+  // Keep the table at most 80% full, with about four strings per bucket
+  while (size < count + count / 4) {
+    size *= 2;
+    index->shift++;
+  }
+  while (buckets * 4 < count) {
+    buckets *= 2;
+  }
+  index->mask = size - 1;
+  index->bucket_mask = buckets - 1;
+  index->slots = xmalloc(size * sizeof(uint32_t));
+  index->displacements = xmalloc(buckets * sizeof(uint32_t));
+
+  mixed = xmalloc(count * sizeof(uint64_t));
+  ids = xmalloc(count * sizeof(uint32_t));
+  starts = xmalloc((buckets + 1) * sizeof(uint32_t));
+  order = xmalloc(buckets * sizeof(uint32_t));
+
+  /*
+   * Try the sampling hash first, since it is the cheaper one to look up
+   * with, then the full hash under successive seeds. Both only fail when
+   * strings hash identically or the table fills up badly, so another seed
+   * of the full hash almost always succeeds.
+   */
+  for (i = 0; ; ++i) {
+    index->sampled = i == 0;
+    index->seed = FNV_SEED + i * 0x61c88647;
+    if (string_index_fill(index, mixed, ids, starts, order)) {
+      break;
+    }
+  }
+
+  xfree(mixed);
+  xfree(ids);
+  xfree(starts);
+  xfree(order);
+}
+
+/*
+ * Builds a frozen copy of `set`, which later changes to the set don't affect.
+ */
+void string_set_freeze(const string_set_t *set, string_index_t *index)
+{
+  const char **strings = xmalloc((set->size ? set->size : 1) * sizeof(char *));
+  uint32_t i, count = 0;
+
+  for (i = 0; i < set->allocated; ++i) {
+    if (set->strings[i]) {
+      strings[count++] = set->strings[i];
+    }
+  }
+
+  string_index_build(index, strings, count);
+  xfree(strings);
+}
+
+uint32_t string_index_lookup(const string_index_t *index,
+                             const char *str, size_t len)
+{
+  uint64_t mixed;
+  uint32_t id;
+
+  if (index->count <= 1) {
+    return index->count && string_index_matches(index, 1, str, len);
+  }
+
+  mixed = string_index_mix(string_index_hash(index, str, len));
+  id = index->slots[string_index_slot(index, mixed,
+    index->displacements[mixed & index->bucket_mask])];
+  return id && string_index_matches(index, id, str, len) ? id : 0;
+}
+
+void string_index_free(string_index_t *index)
+{
+  xfree(index->slots);
+  xfree(index->displacements);
+  xfree(index->offsets);
+  xfree(index->blob);
+}
@@ -14,6 +14,40 @@ void string_set_new(string_set_t *set);
 void string_set_add(string_set_t *set, const char *str);
 void string_set_remove(string_set_t *set, const char *str);
 bool string_set_contains(const string_set_t *set, const char *str);
+bool string_set_contains_n(const string_set_t *set, const char *str, size_t len);
 void string_set_free(string_set_t *set);
 
+/*
+ * A read-only map from a fixed set of distinct strings to the numbers
+ * 1..count, in the order they were given; anything else maps to 0. It is a
+ * perfect hash built by hash-and-displace: strings hash into buckets of
+ * about four, and each bucket stores a displacement, chosen when the index
+ * is built, that moves its strings into slots no other string uses. A
+ * lookup is a hash, one displacement, one probe and one compare. The table
+ * has between 1.25 and 2.5 slots per string. Where it can, the hash looks
+ * at only a few bytes of the string rather than all of it. Empty and
+ * single-string indexes don't hash at all.
+ *
+ * The strings are kept together in one blob, each preceded by its length.
+ */
+typedef struct {
+  uint32_t *slots;
+  uint32_t *displacements;
+  uint32_t *offsets;
+  char *blob;
+  uint32_t mask;
+  uint32_t bucket_mask;
+  uint32_t shift;
+  uint32_t seed;
+  uint32_t count;
+  bool sampled;
+} string_index_t;
+
+void string_index_build(string_index_t *index, const char *const *strings,
+                        uint32_t count);
+uint32_t string_index_lookup(const string_index_t *index,
+                             const char *str, size_t len);
+void string_index_free(string_index_t *index);
+void string_set_freeze(const string_set_t *set, string_index_t *index);
+
 #endif
@@ -76,5 +76,21 @@ module Cleanse
     def wrap_with_whitespace(elements)
       elements.flatten.each { |e| set_flag e, WRAP_WHITESPACE, true }
     end
+
+    # Freezing a sanitizer compiles any settings changed since it was built
+    # and swaps in a deeply frozen copy of its config (the caller's Hash is
+    # left alone), which makes a frozen sanitizer Ractor-shareable.
+    def freeze
+      compile
+      @config = Ractor.make_shareable(@config, copy: true) if defined?(Ractor)
+      super
+    end
+
+    # Shared, frozen sanitizers for the built-in configs. These are built once
+    # at load time; DEFAULT is what gets used when no `sanitizer:` is given.
+    DEFAULT = new(Config::DEFAULT).freeze
+    BASIC = new(Config::BASIC).freeze
+    RELAXED = new(Config::RELAXED).freeze
+    RESTRICTED = new(Config::RESTRICTED).freeze
   end
 end
@@ -6,4 +6,54 @@ class CleanseTest < Minitest::Test
   def test_that_it_has_a_version_number
     refute_nil ::Cleanse::VERSION
   end
+
+  def test_sanitize_matches_document_fragment
+    sanitizer = Cleanse::Sanitizer.new(Cleanse::Sanitizer::Config::RELAXED)
+
+    STRINGS.each_value do |string|
+      assert_equal Cleanse::DocumentFragment.new(string[:html]).to_html,
+                   Cleanse.sanitize(string[:html])
+      assert_equal string[:relaxed], Cleanse.sanitize(string[:html], sanitizer: sanitizer)
+    end
+  end
+
+  def test_sanitize_can_be_turned_off
+    html = "<a href='https://google.com'>wow!</a>"
+    assert_equal '<a href="https://google.com">wow!</a>', Cleanse.sanitize(html, sanitizer: nil)
+  end
+
+  def test_sanitize_documents
+    sanitizer = Cleanse::Sanitizer.new(elements: ["html"])
+    html = "<!doctype html><html><b>foo</b>"
+
+    assert_equal "<!DOCTYPE html><html>foo</html>",
+                 Cleanse.sanitize(html, sanitizer: sanitizer, fragment: false)
+    assert_equal Cleanse::Document.new(html, sanitizer: sanitizer).to_html,
+                 Cleanse.sanitize(html, sanitizer: sanitizer, fragment: false)
+  end
+
+  def test_sanitize_returns_utf8
+    result = Cleanse.sanitize("caf&eacute; <b>ol&eacute;</b>")
+    assert_equal Encoding::UTF_8, result.encoding
+    assert_equal "café olé", result
+  end
+
+  def test_errors_are_only_collected_on_request
+    html = "<p a=1 a=2>foo</b><p>bar"
+
+    assert_empty Cleanse::DocumentFragment.new(html).errors
+
+    errors = Cleanse::DocumentFragment.new(html, max_errors: 10).errors
+    assert_equal 2, errors.length
+    assert_match(/multiple attributes with the same name.*\^/m, errors.first)
+
+    assert_equal 1, Cleanse::Document.new(html, max_errors: 1).errors.length
+    assert_equal Cleanse::DocumentFragment.new(html).to_html,
+                 Cleanse::DocumentFragment.new(html, max_errors: 10).to_html
+  end
+
+  def test_sanitize_raises_on_documents_that_are_too_deep
+    html = nest_html_content("<b>foo</b>", Nokogumbo::DEFAULT_MAX_TREE_DEPTH)
+    assert_raises(RuntimeError) { Cleanse.sanitize(html) }
+  end
 end
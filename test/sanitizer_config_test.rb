@@ -11,6 +11,24 @@ module Cleanse
       verify_deeply_frozen Cleanse::Sanitizer::Config::RESTRICTED
     end
 
+    def test_built_in_sanitizers_should_be_frozen
+      [Sanitizer::DEFAULT, Sanitizer::BASIC, Sanitizer::RELAXED, Sanitizer::RESTRICTED].each do |sanitizer|
+        assert_predicate sanitizer, :frozen?
+        assert_raises(FrozenError) { sanitizer.allow_element(%w[script]) }
+      end
+    end
+
+    def test_built_in_sanitizers_should_match_their_configs
+      STRINGS.each_value do |string|
+        assert_equal string[:default], Cleanse::DocumentFragment.new(string[:html]).to_html
+        assert_equal string[:basic], Cleanse::DocumentFragment.new(string[:html], sanitizer: Sanitizer::BASIC).to_html
+        assert_equal string[:relaxed],
+                     Cleanse::DocumentFragment.new(string[:html], sanitizer: Sanitizer::RELAXED).to_html
+        assert_equal string[:restricted],
+                     Cleanse::DocumentFragment.new(string[:html], sanitizer: Sanitizer::RESTRICTED).to_html
+      end
+    end
+
     def test_should_deeply_freeze_and_return_a_configuration_hash
       a = { one: { one_one: [0, "1", :a], one_two: false, one_three: Set.new(%i[a b c]) } }
       b = Cleanse::Sanitizer::Config.freeze_config(a)
@@ -19,6 +19,8 @@ module Cleanse
           assert_equal("foo bar baz", Cleanse::DocumentFragment.new("foo<div>bar</div>baz").to_html)
           assert_equal("foo bar baz", Cleanse::DocumentFragment.new("foo<br>bar<br>baz").to_html)
           assert_equal("foo bar baz", Cleanse::DocumentFragment.new("foo<hr>bar<hr>baz").to_html)
+          assert_equal("foo  bar &lt; baz",
+                       Cleanse::DocumentFragment.new("foo<div><p>bar</p>&lt;</div>baz").to_html)
         end
 
         def test_should_not_choke_on_several_instances_of_the_same_element_in_a_row
@@ -46,6 +46,192 @@ module Cleanse
       assert_equal '<a href="https://google.com">wow!</a>', doc.to_html
     end
 
+    def test_it_applies_settings_changed_after_compiling
+      sanitizer = Cleanse::Sanitizer.new({ elements: %w[a] })
+      html = "<a href='https://google.com' title=x data-1=y>wow!</a>"
+      assert_equal "<a>wow!</a>", Cleanse.sanitize(html, sanitizer: sanitizer)
+
+      sanitizer.allow_attribute("a", %w[title href])
+      sanitizer.allow_protocol("a", "href", %w[http])
+      assert_equal '<a title="x">wow!</a>', Cleanse.sanitize(html, sanitizer: sanitizer)
+
+      sanitizer.allow_protocol("a", "href", %w[https])
+      sanitizer.allow_attribute(:all, %w[data-1])
+      assert_same sanitizer, sanitizer.compile
+      assert_equal '<a href="https://google.com" title="x" data-1="y">wow!</a>',
+                   Cleanse.sanitize(html, sanitizer: sanitizer)
+    end
+
+    def test_it_keeps_the_rest_of_an_allowlist_when_removing_from_it
+      sanitizer = Cleanse::Sanitizer.new({ elements: %w[p], attributes: { "p" => %w[class] } })
+      classes = (1..200).map { |i| "c#{i}" }
+      removed, kept = classes.partition { |c| c.delete("c").to_i.even? }
+      sanitizer.allow_class("p", classes)
+      removed.each { |c| sanitizer.set_allowed_class("p", c, false) }
+
+      html = "<p class='#{classes.join(" ")}'>x</p>"
+      assert_equal "<p class=\"#{kept.join(" ")}\">x</p>",
+                   Cleanse.sanitize(html, sanitizer: sanitizer)
+    end
+
+    def test_it_sanitizes_deeply_nested_siblings
+      sanitizer = Cleanse::Sanitizer.new({ elements: %w[span b] })
+      depth = Nokogumbo::DEFAULT_MAX_TREE_DEPTH - 2
+      html = nest_html_content("<i>x</i><b>foo</b>", depth) * 2
+      assert_equal nest_html_content("x<b>foo</b>", depth) * 2,
+                   Cleanse.sanitize(html, sanitizer: sanitizer)
+    end
+
+    def test_it_sanitizes_large_inputs_from_several_threads
+      html = "<p>foo <b>bar</b> <script>baz</script></p>" * 500
+      expected = " foo bar  " * 500
+
+      threads = Array.new(4) do
+        Thread.new { Array.new(5) { Cleanse::DocumentFragment.new(html).to_html } }
+      end
+
+      threads.each do |thread|
+        thread.value.each { |result| assert_equal expected, result }
+      end
+    end
+
+    def test_it_sanitizes_large_inputs_while_another_thread_changes_the_sanitizer
+      sanitizer = Cleanse::Sanitizer.new({ elements: %w[b], attributes: { "b" => %w[title] } })
+      html = "<b title=x class=y>foo</b> " * 1000
+      expected = ['<b title="x">foo</b> ' * 1000, "<b>foo</b> " * 1000]
+
+      done = false
+      mutator = Thread.new do
+        until done
+          sanitizer.allow_attribute("b", %w[title])
+          sanitizer.disallow_attribute("b", %w[title])
+          Thread.pass
+        end
+      end
+
+      50.times do
+        assert_includes expected, Cleanse.sanitize(html, sanitizer: sanitizer)
+        assert_includes expected, Cleanse::DocumentFragment.new(html, sanitizer: sanitizer).to_html
+      end
+    ensure
+      done = true
+      mutator&.join
+    end
+
+    def test_sanitize_all_returns_results_in_order
+      inputs = STRINGS.values.map { |string| string[:html] } * 50
+      expected = inputs.map { |html| Cleanse::DocumentFragment.new(html, sanitizer: Sanitizer::RELAXED).to_html }
+
+      assert_equal expected, Sanitizer::RELAXED.sanitize_all(inputs)
+      assert_equal expected, Sanitizer::RELAXED.sanitize_all(inputs, threads: 1)
+      assert_equal expected, Sanitizer::RELAXED.sanitize_all(inputs, threads: 4)
+      assert_equal [], Sanitizer::RELAXED.sanitize_all([])
+    end
+
+    def test_sanitize_all_documents
+      sanitizer = Cleanse::Sanitizer.new(elements: ["html"])
+      assert_equal ["<!DOCTYPE html><html>foo</html>"],
+                   sanitizer.sanitize_all(["<!doctype html><html><b>foo</b>"], fragment: false)
+    end
+
+    def test_sanitize_all_validates_its_input
+      assert_raises(TypeError) { Sanitizer::DEFAULT.sanitize_all(["ok", 1]) }
+      assert_raises(ArgumentError) { Sanitizer::DEFAULT.sanitize_all(["ok"], threads: 0) }
+      assert_raises(RuntimeError) do
+        Sanitizer::DEFAULT.sanitize_all(["ok", nest_html_content("foo", Nokogumbo::DEFAULT_MAX_TREE_DEPTH)] * 100)
+      end
+    end
+
+    def test_sanitize_all_uses_one_set_of_settings_while_another_thread_changes_them
+      sanitizer = Cleanse::Sanitizer.new({ elements: %w[b], attributes: { "b" => %w[title] } })
+      inputs = ["<b title=x class=y>foo</b> " * 200] * 50
+      expected = ['<b title="x">foo</b> ' * 200, "<b>foo</b> " * 200]
+
+      done = false
+      mutator = Thread.new do
+        until done
+          sanitizer.allow_attribute("b", %w[title])
+          sanitizer.disallow_attribute("b", %w[title])
+          Thread.pass
+        end
+      end
+
+      10.times do
+        results = sanitizer.sanitize_all(inputs, threads: 4).uniq
+        assert_equal 1, results.size
+        assert_includes expected, results.first
+      end
+    ensure
+      done = true
+      mutator&.join
+    end
+
+    def test_frozen_sanitizers_are_ractor_shareable
+      skip "Ractor is not available" unless defined?(Ractor)
+
+      config = { elements: %w[b] }
+      sanitizer = Cleanse::Sanitizer.new(config).freeze
+
+      assert Ractor.shareable?(Sanitizer::DEFAULT)
+      assert Ractor.shareable?(sanitizer)
+      refute config.frozen?
+      refute Ractor.shareable?(Cleanse::Sanitizer.new(config))
+    end
+
+    def test_it_sanitizes_from_several_ractors
+      skip "Ractor is not available" unless defined?(Ractor)
+
+      experimental = Warning[:experimental]
+      Warning[:experimental] = false
+      sanitizer = Cleanse::Sanitizer.new(elements: %w[b]).freeze
+
+      ractors = Array.new(2) do
+        Ractor.new(sanitizer) do |s|
+          [
+            Cleanse::DocumentFragment.new("<b>foo</b><i>bar</i>", sanitizer: s).to_html,
+            Cleanse.sanitize("<p>foo <script>bar</script></p>")
+          ]
+        end
+      end
+
+      ractors.each { |r| assert_equal ["<b>foo</b>bar", " foo  "], r.take }
+    ensure
+      Warning[:experimental] = experimental if defined?(Ractor)
+    end
+
+    def test_it_sanitizes_from_several_ractors_after_make_shareable
+      skip "Ractor is not available" unless defined?(Ractor)
+
+      experimental = Warning[:experimental]
+      Warning[:experimental] = false
+      sanitizer = Cleanse::Sanitizer.new(elements: %w[b])
+      sanitizer.allow_element(%w[i])
+      Ractor.make_shareable(sanitizer)
+
+      ractors = Array.new(4) do
+        Ractor.new(sanitizer) do |s|
+          Array.new(20) { Cleanse.sanitize("<b>foo</b><i>bar</i><u>baz</u>", sanitizer: s) }.uniq
+        end
+      end
+
+      ractors.each { |r| assert_equal ["<b>foo</b><i>bar</i>baz"], r.take }
+    ensure
+      Warning[:experimental] = experimental if defined?(Ractor)
+    end
+
+    def test_freezing_compiles_changes_made_after_new
+      sanitizer = Cleanse::Sanitizer.new(elements: %w[b])
+      sanitizer.allow_element(%w[i])
+      sanitizer.freeze
+
+      assert_equal "<b>foo</b><i>bar</i>baz",
+                   Cleanse.sanitize("<b>foo</b><i>bar</i><u>baz</u>", sanitizer: sanitizer)
+    end
+
+    def test_frozen_sanitizers_cannot_be_recompiled
+      assert_raises(FrozenError) { Sanitizer::DEFAULT.compile }
+    end
+
     describe "#document" do
       def setup
         @sanitizer = Cleanse::Sanitizer.new(elements: ["html"])
@@ -162,6 +348,23 @@ module Cleanse
         assert_equal("az", Cleanse::DocumentFragment.new("a#{sample_non_chars}z", sanitizer: @sanitizer).to_html)
       end
 
+      def test_should_strip_the_same_bytes_at_any_offset
+        dirty = ["\u0001", "\u007f", "\u009f", "é", "￾", "\u{1f600}"]
+        (0..70).each do |offset|
+          html = ("abc def\tghi\njkl" * 5).insert(offset, dirty[offset % dirty.size] * (offset % 3 + 1))
+          assert_equal(html.delete("^\t\n\f\r -~"),
+                       Cleanse::DocumentFragment.new(html, sanitizer: @sanitizer).to_html)
+        end
+      end
+
+      def test_should_strip_control_characters_inside_markup
+        assert_equal('<foo title="&amp;bogus &amp;">&amp;</foo>',
+                     Cleanse::DocumentFragment.new("<f\u0001oo title=\"&bo\u0002gus &am\u0003p;\">&a\u007fmp;</foo>",
+                                                   sanitizer: nil).to_html)
+        assert_equal("<!-- x -->",
+                     Cleanse::DocumentFragment.new("<!-\u0001- x --\u0080>", sanitizer: nil).to_html)
+      end
+
       describe "when html body exceeds Nokogumbo::DEFAULT_MAX_TREE_DEPTH" do
         def setup
           html = nest_html_content("<b>foo</b>", Nokogumbo::DEFAULT_MAX_TREE_DEPTH)